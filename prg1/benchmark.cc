@@ -0,0 +1,444 @@
+// Benchmark.cc
+//
+// Standalone microbenchmarks of Datastructures operations. Every benchmark
+// runs a number of operations per repetition against a datastructure filled
+// with n random places and areas (generated the same way as in perftest), and
+// reports statistics of the time per operation over the repetitions. Warmup
+// repetitions are run first and not included in the statistics.
+//
+// The benchmarks named "sharded" run against a ShardedDatastructures with
+// the same places (but no areas), using one shard per hardware thread.
+//
+// Usage: benchmark [n=places] [reps=repetitions] [warmup=repetitions] [ops=operations] [filter]
+// Only benchmarks whose name contains the filter string are run.
+
+#include "datastructures.hh"
+#include "shards.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+struct Settings
+{
+    unsigned int n = 100000;
+    unsigned int reps = 10;
+    unsigned int warmup = 2;
+    unsigned int ops = 10000;
+    std::string filter;
+};
+
+// Datastructure with n random places (and an area for every 10 places, linked
+// into a binary tree), and helpers for picking random existing data
+class Fixture
+{
+public:
+    explicit Fixture(unsigned int n);
+
+    PlaceID random_place();
+    AreaID random_area();
+    Name const& random_name();
+    Coord random_coord();
+    PlaceType random_type();
+
+    // Generates a new place, which is not in the datastructure
+    PlaceID new_place_id();
+
+    // Picks random places and new random names and coordinates for them into
+    // pending, and restores the original names and coordinates afterwards
+    void pick_changes(unsigned int count);
+    void restore_changes();
+
+    // Picks random places and new random names for them into batch, and the
+    // mutations restoring the original names into undo_batch
+    void pick_renames(unsigned int count);
+
+    Datastructures ds;
+    ShardedDatastructures sharded;
+    std::vector<PlaceID> places;
+    std::vector<AreaID> areas;
+    std::vector<Name> names;
+    std::minstd_rand rand;
+
+    // Data of places removed or added by the operation being measured, so
+    // that the fixture can be restored afterwards
+    std::vector<std::tuple<PlaceID, Name, PlaceType, Coord>> pending;
+    std::vector<Mutation> batch;
+    std::vector<Mutation> undo_batch;
+
+private:
+    template <typename Type>
+    Type random(Type start, Type end); // [start, end)
+
+    PlaceID next_new_id_ = 0;
+    std::vector<std::tuple<PlaceID, Name, PlaceType, Coord>> originals_;
+};
+
+Fixture::Fixture(unsigned int n)
+{
+    unsigned long int const prime1 = 4943;
+    unsigned long int const prime2 = 81031;
+
+    std::vector<Mutation> additions;
+    for (unsigned int i = 0; i < n; ++i)
+    {
+        unsigned long int hash = prime1*i + prime2;
+        Name name;
+        while (hash > 0)
+        {
+            name.push_back('a' + hash % 26);
+            hash /= 26;
+        }
+        PlaceID id = prime2*i + prime1;
+        auto type = random_type();
+        auto coord = random_coord();
+        ds.add_place(id, name, type, coord);
+        additions.push_back({Mutation::Type::ADD_PLACE, id, name, type, coord});
+        places.push_back(id);
+        names.push_back(name);
+
+        // Add a new area for every 10 places
+        if (i % 10 == 0)
+        {
+            AreaID areaid = id;
+            ds.add_area(areaid, name, {random_coord(), random_coord(), random_coord()});
+            if (!areas.empty())
+            {
+                ds.add_subarea_to_area(areaid, areas[areas.size() / 2]);
+            }
+            areas.push_back(areaid);
+        }
+    }
+    next_new_id_ = static_cast<PlaceID>(prime2*n + prime1) + 1;
+    ds.creation_finished();
+    sharded.apply_batch(additions);
+    sharded.creation_finished();
+}
+
+template <typename Type>
+Type Fixture::random(Type start, Type end)
+{
+    return static_cast<Type>(start + std::uniform_int_distribution<unsigned long int>(0, end-start-1)(rand));
+}
+
+PlaceID Fixture::random_place()
+{
+    return places.empty() ? NO_PLACE : places[random<std::size_t>(0, places.size())];
+}
+
+AreaID Fixture::random_area()
+{
+    return areas.empty() ? NO_AREA : areas[random<std::size_t>(0, areas.size())];
+}
+
+Name const& Fixture::random_name()
+{
+    return names.empty() ? NO_NAME : names[random<std::size_t>(0, names.size())];
+}
+
+Coord Fixture::random_coord()
+{
+    return {random(1, 10001), random(1, 10001)};
+}
+
+PlaceType Fixture::random_type()
+{
+    return PlaceType{random(0, static_cast<int>(PlaceType::NO_TYPE))};
+}
+
+PlaceID Fixture::new_place_id()
+{
+    return next_new_id_++;
+}
+
+void Fixture::pick_changes(unsigned int count)
+{
+    pending.clear();
+    originals_.clear();
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        auto id = random_place();
+        auto [name, type] = ds.get_place_name_type(id);
+        originals_.emplace_back(id, name, type, ds.get_place_coord(id));
+        pending.emplace_back(id, random_name(), type, random_coord());
+    }
+}
+
+void Fixture::restore_changes()
+{
+    // In reverse order, so that places picked twice get their original data
+    for (auto iter = originals_.rbegin(); iter != originals_.rend(); ++iter)
+    {
+        auto& [id, name, type, coord] = *iter;
+        ds.change_place_name(id, name);
+        ds.change_place_coord(id, coord);
+    }
+}
+
+void Fixture::pick_renames(unsigned int count)
+{
+    batch.clear();
+    undo_batch.clear();
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        auto id = random_place();
+        batch.push_back({Mutation::Type::CHANGE_PLACE_NAME, id, random_name()});
+        undo_batch.push_back({Mutation::Type::CHANGE_PLACE_NAME, id, ds.get_place_name_type(id).first});
+    }
+    // In reverse order, so that places picked twice get their original name
+    std::reverse(undo_batch.begin(), undo_batch.end());
+}
+
+struct Benchmark
+{
+    std::string name;
+    // The measured operations are run ops/ops_divisor times per repetition
+    unsigned int ops_divisor;
+    std::function<void(Fixture&, unsigned int ops)> body;
+    // Optional, run before and after every repetition without measuring
+    std::function<void(Fixture&, unsigned int ops)> setup = {};
+    std::function<void(Fixture&, unsigned int ops)> teardown = {};
+};
+
+// Prevents the compiler from optimizing away results that are not used
+void const* volatile keep_sink = nullptr;
+
+template <typename Type>
+void keep(Type const& value)
+{
+    keep_sink = &value;
+}
+
+std::vector<Benchmark> const benchmarks =
+{
+    {"get_place_name_type", 1, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.ds.get_place_name_type(f.random_place())); } }},
+    {"get_place_coord", 1, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.ds.get_place_coord(f.random_place())); } }},
+    {"get_area_name", 1, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.ds.get_area_name(f.random_area())); } }},
+    {"find_places_name", 1, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.ds.find_places_name(f.random_name())); } }},
+    {"find_places_type", 100, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.ds.find_places_type(f.random_type())); } }},
+    {"change_place_name", 1,
+     [](Fixture& f, unsigned int /*ops*/){
+         for (auto& [id, name, type, coord] : f.pending) { f.ds.change_place_name(id, name); } },
+     [](Fixture& f, unsigned int ops){ f.pick_changes(ops); },
+     [](Fixture& f, unsigned int /*ops*/){ f.restore_changes(); }},
+    {"change_place_coord", 1,
+     [](Fixture& f, unsigned int /*ops*/){
+         for (auto& [id, name, type, coord] : f.pending) { f.ds.change_place_coord(id, coord); } },
+     [](Fixture& f, unsigned int ops){ f.pick_changes(ops); },
+     [](Fixture& f, unsigned int /*ops*/){ f.restore_changes(); }},
+    {"places_alphabetically (cached)", 100, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.ds.places_alphabetically()); } }},
+    {"places_alphabetically (after change)", 1000, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i)
+         {
+             auto id = f.random_place();
+             f.ds.change_place_name(id, f.ds.get_place_name_type(id).first);
+             keep(f.ds.places_alphabetically());
+         } }},
+    {"places_coord_order (cached)", 100, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.ds.places_coord_order()); } }},
+    {"places_alphabetically_view (cached)", 1, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.ds.places_alphabetically_view()); } }},
+    {"all_places_view (cached)", 1, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.ds.all_places_view()); } }},
+    {"places_coord_order (after change)", 1000, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i)
+         {
+             auto id = f.random_place();
+             f.ds.change_place_coord(id, f.ds.get_place_coord(id));
+             keep(f.ds.places_coord_order());
+         } }},
+    {"places_closest_to", 100, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.ds.places_closest_to(f.random_coord(), f.random_type())); } }},
+    {"subarea_in_areas", 1, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.ds.subarea_in_areas(f.random_area())); } }},
+    {"all_subareas_in_area", 1, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.ds.all_subareas_in_area(f.random_area())); } }},
+    {"common_area_of_subareas", 1, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.ds.common_area_of_subareas(f.random_area(), f.random_area())); } }},
+    {"add_place", 1,
+     [](Fixture& f, unsigned int /*ops*/){
+         for (auto& [id, name, type, coord] : f.pending) { f.ds.add_place(id, name, type, coord); } },
+     [](Fixture& f, unsigned int ops){
+         f.pending.clear();
+         for (unsigned int i = 0; i < ops; ++i)
+         {
+             f.pending.emplace_back(f.new_place_id(), f.random_name(), f.random_type(), f.random_coord());
+         } },
+     [](Fixture& f, unsigned int /*ops*/){
+         for (auto& pending : f.pending) { f.ds.remove_place(std::get<0>(pending)); } }},
+    {"remove_place", 1,
+     [](Fixture& f, unsigned int /*ops*/){
+         for (auto& pending : f.pending) { f.ds.remove_place(std::get<0>(pending)); } },
+     [](Fixture& f, unsigned int ops){
+         f.pending.clear();
+         for (unsigned int i = 0; i < ops; ++i)
+         {
+             auto id = f.random_place();
+             auto [name, type] = f.ds.get_place_name_type(id);
+             f.pending.emplace_back(id, name, type, f.ds.get_place_coord(id));
+         } },
+     [](Fixture& f, unsigned int /*ops*/){
+         // Removed places are added back, the same place may have been picked twice
+         for (auto& [id, name, type, coord] : f.pending) { f.ds.add_place(id, name, type, coord); } }},
+    {"apply_batch (rename)", 1,
+     [](Fixture& f, unsigned int /*ops*/){ f.ds.apply_batch(f.batch); },
+     [](Fixture& f, unsigned int ops){ f.pick_renames(ops); },
+     [](Fixture& f, unsigned int /*ops*/){ f.ds.apply_batch(f.undo_batch); }},
+    {"sharded apply_batch (rename)", 1,
+     [](Fixture& f, unsigned int /*ops*/){ f.sharded.apply_batch(f.batch); },
+     [](Fixture& f, unsigned int ops){ f.pick_renames(ops); },
+     [](Fixture& f, unsigned int /*ops*/){ f.sharded.apply_batch(f.undo_batch); }},
+    {"sharded get_place_coord", 1, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.sharded.get_place_coord(f.random_place())); } }},
+    {"sharded find_places_name", 1, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.sharded.find_places_name(f.random_name())); } }},
+    {"sharded places_alphabetically (cached)", 100, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.sharded.places_alphabetically()); } }},
+    {"sharded places_coord_order (cached)", 100, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.sharded.places_coord_order()); } }},
+    {"sharded places_closest_to", 100, [](Fixture& f, unsigned int ops){
+         for (unsigned int i = 0; i < ops; ++i) { keep(f.sharded.places_closest_to(f.random_coord(), f.random_type())); } }},
+};
+
+struct Statistics
+{
+    double mean = 0;
+    double stddev = 0;
+    double min = 0;
+    double median = 0;
+    double max = 0;
+};
+
+Statistics calculate_statistics(std::vector<double> values)
+{
+    Statistics stats;
+    if (values.empty()) { return stats; }
+
+    std::sort(values.begin(), values.end());
+    stats.min = values.front();
+    stats.max = values.back();
+    auto mid = values.size() / 2;
+    stats.median = (values.size() % 2 == 1) ? values[mid] : (values[mid-1] + values[mid]) / 2;
+
+    for (auto value : values) { stats.mean += value; }
+    stats.mean /= values.size();
+
+    if (values.size() > 1)
+    {
+        double sumsq = 0;
+        for (auto value : values) { sumsq += (value - stats.mean) * (value - stats.mean); }
+        stats.stddev = std::sqrt(sumsq / (values.size() - 1));
+    }
+    return stats;
+}
+
+// Returns the time per operation (in nanoseconds) of each measured repetition
+std::vector<double> run_benchmark(Benchmark const& benchmark, Fixture& fixture, Settings const& settings)
+{
+    using Clock = std::chrono::steady_clock;
+
+    unsigned int ops = std::max(1u, settings.ops / benchmark.ops_divisor);
+    std::vector<double> results;
+    for (unsigned int rep = 0; rep < settings.warmup + settings.reps; ++rep)
+    {
+        if (benchmark.setup) { benchmark.setup(fixture, ops); }
+
+        auto start = Clock::now();
+        benchmark.body(fixture, ops);
+        auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+
+        if (benchmark.teardown) { benchmark.teardown(fixture, ops); }
+
+        if (rep >= settings.warmup)
+        {
+            results.push_back(elapsed / ops);
+        }
+    }
+    return results;
+}
+
+Settings parse_arguments(int argc, char* argv[])
+{
+    Settings settings;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto eq = arg.find('=');
+        if (eq == std::string::npos)
+        {
+            settings.filter = arg;
+            continue;
+        }
+
+        std::string key = arg.substr(0, eq);
+        auto value = static_cast<unsigned int>(std::stoul(arg.substr(eq+1)));
+        if (key == "n") { settings.n = value; }
+        else if (key == "reps") { settings.reps = std::max(1u, value); }
+        else if (key == "warmup") { settings.warmup = value; }
+        else if (key == "ops") { settings.ops = std::max(1u, value); }
+        else { throw std::invalid_argument("Unknown parameter '" + key + "'"); }
+    }
+    return settings;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Settings settings;
+    try
+    {
+        settings = parse_arguments(argc, argv);
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        std::cerr << "Usage: " << argv[0] << " [n=places] [reps=repetitions] [warmup=repetitions] [ops=operations] [filter]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+#ifdef _GLIBCXX_DEBUG
+    std::cout << "WARNING: Debug STL enabled, performance will be worse than expected (maybe also asymptotically)!" << std::endl;
+#endif // _GLIBCXX_DEBUG
+
+    std::cout << "Benchmarking with " << settings.n << " places, " << settings.warmup << " warmup and "
+              << settings.reps << " measured repetitions of " << settings.ops << " operations" << std::endl
+              << "(operations that are linear or worse are repeated 100 or 1000 times less)" << std::endl << std::endl;
+
+    std::cout << std::setw(38) << std::left << "benchmark" << std::right << " , " << std::setw(6) << "ops"
+              << " , " << std::setw(12) << "mean (ns)" << " , " << std::setw(10) << "stddev"
+              << " , " << std::setw(12) << "min (ns)" << " , " << std::setw(12) << "median (ns)"
+              << " , " << std::setw(12) << "max (ns)" << std::endl;
+
+    Fixture fixture(settings.n);
+    for (auto& benchmark : benchmarks)
+    {
+        if (benchmark.name.find(settings.filter) == std::string::npos) { continue; }
+
+        auto stats = calculate_statistics(run_benchmark(benchmark, fixture, settings));
+        std::cout << std::setw(38) << std::left << benchmark.name << std::right
+                  << " , " << std::setw(6) << std::max(1u, settings.ops / benchmark.ops_divisor)
+                  << " , " << std::setw(12) << stats.mean << " , " << std::setw(10) << stats.stddev
+                  << " , " << std::setw(12) << stats.min << " , " << std::setw(12) << stats.median
+                  << " , " << std::setw(12) << stats.max << std::endl;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,23 @@
+# Standalone microbenchmarks of the Datastructures operations. Links
+# datastructures.cc directly, without the command parsing of the main program.
+# Usage: benchmark [n=places] [reps=repetitions] [warmup=repetitions] [ops=operations] [filter]
+
+# Benchmarks should always be built with optimizations
+CONFIG += c++17 warn_on console release thread
+CONFIG -= qt app_bundle
+
+TARGET = benchmark
+TEMPLATE = app
+
+SOURCES += \
+    benchmark.cc \
+    datastructures.cc \
+    changefeed.cc \
+    shards.cc
+
+HEADERS += \
+    datastructures.hh \
+    changefeed.hh \
+    ordertree.hh \
+    listview.hh \
+    shards.hh
@@ -0,0 +1,89 @@
+// Changefeed.cc
+
+#include "changefeed.hh"
+
+namespace
+{
+
+void event_to_words(ChangeEvent const& event, std::uint64_t (&words)[4])
+{
+    words[0] = static_cast<std::uint64_t>(event.type);
+    words[1] = static_cast<std::uint64_t>(event.id);
+    words[2] = static_cast<std::uint64_t>(event.id2);
+    words[3] = (static_cast<std::uint64_t>(static_cast<std::uint32_t>(event.xy.x)) << 32) | static_cast<std::uint32_t>(event.xy.y);
+}
+
+ChangeEvent words_to_event(std::uint64_t const (&words)[4])
+{
+    ChangeEvent event{static_cast<ChangeEvent::Type>(words[0])};
+    event.id = static_cast<long long int>(words[1]);
+    event.id2 = static_cast<long long int>(words[2]);
+    event.xy.x = static_cast<int>(static_cast<std::uint32_t>(words[3] >> 32));
+    event.xy.y = static_cast<int>(static_cast<std::uint32_t>(words[3]));
+    return event;
+}
+
+} // namespace
+
+ChangeFeed::ChangeFeed(std::size_t capacity)
+{
+    std::size_t size = 1;
+    while (size < capacity) { size *= 2; }
+    slots_ = std::make_unique<Slot[]>(size);
+    mask_ = size - 1;
+}
+
+void ChangeFeed::publish(ChangeEvent const& event)
+{
+    auto sequence = head_.load(std::memory_order_relaxed);
+    auto& slot = slots_[sequence & mask_];
+
+    // Mark the slot as being written, so that readers of the old event see
+    // that it has changed
+    slot.sequence.store(~std::uint64_t(0), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    std::uint64_t words[SLOT_WORDS];
+    event_to_words(event, words);
+    for (std::size_t i = 0; i < SLOT_WORDS; ++i)
+    {
+        slot.words[i].store(words[i], std::memory_order_relaxed);
+    }
+
+    slot.sequence.store(sequence, std::memory_order_release);
+    head_.store(sequence + 1, std::memory_order_release);
+}
+
+bool ChangeFeed::read(Cursor& cursor, std::vector<ChangeEvent>& events, std::size_t max_events) const
+{
+    auto head = head_.load(std::memory_order_acquire);
+    for (std::size_t read = 0; cursor.next < head && read < max_events; ++read)
+    {
+        if (head - cursor.next > mask_ + 1)
+        {
+            cursor.next = head;
+            return false;
+        }
+
+        auto& slot = slots_[cursor.next & mask_];
+        std::uint64_t words[SLOT_WORDS] = {};
+        if (slot.sequence.load(std::memory_order_acquire) == cursor.next)
+        {
+            for (std::size_t i = 0; i < SLOT_WORDS; ++i)
+            {
+                words[i] = slot.words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        // The producer overwrote the slot while it was being read
+        if (slot.sequence.load(std::memory_order_relaxed) != cursor.next)
+        {
+            cursor.next = head_.load(std::memory_order_acquire);
+            return false;
+        }
+
+        events.push_back(words_to_event(words));
+        ++cursor.next;
+    }
+    return true;
+}
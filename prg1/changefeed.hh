@@ -0,0 +1,83 @@
+// Changefeed.hh
+//
+// Feed of the changes made to Datastructures, so that views and derived
+// indexes can follow the data incrementally
+
+#ifndef CHANGEFEED_HH
+#define CHANGEFEED_HH
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "datastructures.hh"
+
+struct ChangeEvent
+{
+    enum class Type : std::uint8_t
+    {
+        PLACE_ADDED,    // id, xy
+        PLACE_RENAMED,  // id
+        PLACE_MOVED,    // id, xy = new coordinate
+        PLACE_REMOVED,  // id
+        AREA_ADDED,     // id
+        SUBAREA_LINKED, // id = subarea, id2 = parent area
+        CLEARED         // All places and areas were removed
+    };
+    Type type;
+    long long int id = 0;
+    long long int id2 = 0;
+    Coord xy = NO_COORD;
+};
+
+// Ring buffer of the latest events. There is one producer (the thread that
+// modifies the data), and any number of consumers, each reading from its own
+// cursor at its own pace. Neither publishing nor reading takes a lock. The
+// producer never waits for consumers: a consumer that falls more than
+// capacity events behind gets an overrun and has to resynchronize from the
+// data itself.
+class ChangeFeed
+{
+public:
+    explicit ChangeFeed(std::size_t capacity = 1 << 14); // Rounded up to a power of two
+
+    ChangeFeed(ChangeFeed const&) = delete;
+    ChangeFeed& operator=(ChangeFeed const&) = delete;
+
+    void publish(ChangeEvent const& event);
+
+    // Sequence number of the next event to be published
+    std::uint64_t head() const { return head_.load(std::memory_order_acquire); }
+
+    // Position of a consumer in the feed
+    struct Cursor
+    {
+        std::uint64_t next = 0; // Sequence number of the next event to read
+    };
+
+    // Cursor that starts from the next published event
+    Cursor subscribe() const { return {head()}; }
+
+    // Appends the events after the cursor (at most max_events) to events and
+    // advances the cursor. Returns false if events were lost because the
+    // consumer fell too far behind; the cursor is then moved to the head.
+    bool read(Cursor& cursor, std::vector<ChangeEvent>& events, std::size_t max_events = SIZE_MAX) const;
+
+private:
+    // Events are stored as words, so that a consumer can read a slot while
+    // the producer overwrites it, and detect it from the sequence number
+    static std::size_t const SLOT_WORDS = 4;
+    struct Slot
+    {
+        std::atomic<std::uint64_t> sequence{~std::uint64_t(0)}; // Event in the slot, ~0 if none
+        std::atomic<std::uint64_t> words[SLOT_WORDS] = {};
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    std::size_t mask_;
+    std::atomic<std::uint64_t> head_{0};
+};
+
+#endif // CHANGEFEED_HH
@@ -2,10 +2,53 @@
 
 #include "datastructures.hh"
 
+#include "changefeed.hh"
+
 #include <random>
 
 #include <cmath>
 
+#include <thread>
+
+#include <iterator>
+
+#ifdef DATASTRUCTURES_STATS
+#include <chrono>
+
+namespace
+{
+// Adds one call and its duration to the operation's statistics when the
+// operation returns
+class OperationTimer
+{
+public:
+    explicit OperationTimer(Datastructures::OperationStats& stats) :
+        stats_(stats),
+        start_(std::chrono::steady_clock::now())
+    {}
+    ~OperationTimer()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        ++stats_.calls;
+        stats_.total_ns += static_cast<unsigned long long int>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+    OperationTimer(OperationTimer const&) = delete;
+    OperationTimer& operator=(OperationTimer const&) = delete;
+
+private:
+    Datastructures::OperationStats& stats_;
+    std::chrono::steady_clock::time_point start_;
+};
+}
+
+#define STATS_OPERATION(operation) \
+    OperationTimer operation_timer(stats_.operations[static_cast<std::size_t>(Operation::operation)])
+#define STATS_EVENT(counter) (++stats_.counter)
+#else
+#define STATS_OPERATION(operation) ((void)0)
+#define STATS_EVENT(counter) ((void)0)
+#endif // DATASTRUCTURES_STATS
+
 std::minstd_rand rand_engine; // Reasonably quick pseudo-random generator
 
 template <typename Type>
@@ -19,11 +62,49 @@ Type random_in_range(Type start, Type end)
     return static_cast<Type>(start+num);
 }
 
+namespace
+{
+// Order of areas when choosing the innermost area of a place
+bool inner_area(Area const* area1, Area const* area2)
+{
+    return area1->size < area2->size || (area1->size == area2->size && area1->id < area2->id);
+}
+
+// Removes the items for which is_changed is true from the vector sorted by
+// key, and merges the changed items back in the order of their new keys. The
+// keys are looked up once per item, as looking them up in each comparison
+// would dominate the time.
+template <typename Item, typename IsChanged, typename KeyOf, typename Less>
+void merge_changed(std::vector<Item>& sorted, std::vector<Item> const& changed, IsChanged is_changed, KeyOf key_of, Less less)
+{
+    using Keyed = std::pair<decltype(key_of(sorted.front())), Item>;
+    auto keyed_less = [&less](Keyed const& item1, Keyed const& item2) { return less(item1.first, item2.first); };
+
+    std::vector<Keyed> kept;
+    kept.reserve(sorted.size());
+    for (auto const& item : sorted)
+    {
+        if (!is_changed(item)) { kept.push_back({key_of(item), item}); }
+    }
+    std::vector<Keyed> added;
+    added.reserve(changed.size());
+    for (auto const& item : changed) { added.push_back({key_of(item), item}); }
+    std::sort(added.begin(), added.end(), keyed_less);
+
+    std::vector<Keyed> merged;
+    merged.reserve(kept.size() + added.size());
+    std::merge(kept.begin(), kept.end(), added.begin(), added.end(), std::back_inserter(merged), keyed_less);
+    sorted.clear();
+    for (auto& item : merged) { sorted.push_back(std::move(item.second)); }
+}
+}
+
 Datastructures::Datastructures():
     id_datastructure_({}),
     name_datastructure_({}),
     coord_changed_(true),
-    name_changed_(true)
+    name_changed_(true),
+    change_feed_(std::make_unique<ChangeFeed>())
 {
     // Replace this comment with your implementation
 }
@@ -35,22 +116,41 @@ Datastructures::~Datastructures()
 
 int Datastructures::place_count()
 {
+    STATS_OPERATION(PLACE_COUNT);
     int size = static_cast<int>(id_datastructure_.size());
     return size;
 }
 
+std::uint64_t Datastructures::generation() const
+{
+    return change_feed_->head();
+}
+
 void Datastructures::clear_all()
 {
+    STATS_OPERATION(CLEAR_ALL);
     id_datastructure_.clear();
     id_areastructure_.clear();
     name_datastructure_.clear();
     type_datastructure_.clear();
     coord_changed_ = true;
+    spatial_changed_ = true;
+    area_index_changed_ = true;
+    membership_changed_ = true;
+    added_areas_.clear();
     name_changed_ = true;
+    place_ids_changed_ = true;
+    area_ids_changed_ = true;
+    invalidate_order_trees();
+    compacted_places_ = nullptr;
+    compacted_count_ = 0;
+    compacted_removed_ = 0;
+    change_feed_->publish({ChangeEvent::Type::CLEARED});
 }
 
 std::vector<PlaceID> Datastructures::all_places()
 {
+    STATS_OPERATION(ALL_PLACES);
     std::vector<PlaceID> all_place {};
     for( auto iter = id_datastructure_.begin(); iter != id_datastructure_.end(); ++iter )
     {
@@ -59,8 +159,22 @@ std::vector<PlaceID> Datastructures::all_places()
     return all_place;
 }
 
+ListView<PlaceID> Datastructures::all_places_view()
+{
+    STATS_OPERATION(ALL_PLACES);
+    if (place_ids_changed_)
+    {
+        place_ids_.clear();
+        place_ids_.reserve(id_datastructure_.size());
+        for (auto& [id, place] : id_datastructure_) { place_ids_.push_back(id); }
+        place_ids_changed_ = false;
+    }
+    return {place_ids_, generation()};
+}
+
 bool Datastructures::add_place(PlaceID id, const Name& name, PlaceType type, Coord xy)
 {
+    STATS_OPERATION(ADD_PLACE);
     std::shared_ptr<Place> new_place = std::make_shared<Place>(id, name, type, xy);
     bool value = id_datastructure_.insert({id, new_place}).second;
     if ( not value)
@@ -69,13 +183,20 @@ bool Datastructures::add_place(PlaceID id, const Name& name, PlaceType type, Coo
     }
     name_datastructure_.insert({name, new_place});
     type_datastructure_.insert({type, new_place});
+    update_place_area(*new_place);
+    if (name_tree_valid_) { name_tree_.insert(new_place.get()); }
+    if (coord_tree_valid_) { coord_tree_.insert(new_place.get()); }
     coord_changed_ = true;
+    spatial_changed_ = true;
     name_changed_ = true;
+    place_ids_changed_ = true;
+    change_feed_->publish({ChangeEvent::Type::PLACE_ADDED, id, 0, xy});
     return value;
 }
 
 std::pair<Name, PlaceType> Datastructures::get_place_name_type(PlaceID id)
 {
+    STATS_OPERATION(GET_PLACE_NAME_TYPE);
     auto iterator = id_datastructure_.find(id);
     if( iterator == id_datastructure_.end() )
     {
@@ -88,6 +209,7 @@ std::pair<Name, PlaceType> Datastructures::get_place_name_type(PlaceID id)
 
 Coord Datastructures::get_place_coord(PlaceID id)
 {
+    STATS_OPERATION(GET_PLACE_COORD);
     auto iterator = id_datastructure_.find(id);
     if( iterator == id_datastructure_.end() ){
         return NO_COORD;
@@ -99,13 +221,27 @@ Coord Datastructures::get_place_coord(PlaceID id)
 
 bool Datastructures::add_area(AreaID id, const Name &name, std::vector<Coord> coords)
 {
+    STATS_OPERATION(ADD_AREA);
     std::shared_ptr<Area> new_area = std::make_shared<Area>(id, name, coords);
+    new_area->size = polygon_area(new_area->coordinates);
     bool value = id_areastructure_.insert({id, new_area}).second;
+    spatial_changed_ = spatial_changed_ || value;
+    area_index_changed_ = area_index_changed_ || value;
+    if (value && !membership_changed_)
+    {
+        added_areas_.push_back(new_area.get());
+    }
+    if (value)
+    {
+        area_ids_changed_ = true;
+        change_feed_->publish({ChangeEvent::Type::AREA_ADDED, id});
+    }
     return value;
 }
 
 Name Datastructures::get_area_name(AreaID id)
 {
+    STATS_OPERATION(GET_AREA_NAME);
     auto area = id_areastructure_.find(id);
     if ( area == id_areastructure_.end()){
         return NO_NAME;
@@ -116,6 +252,7 @@ Name Datastructures::get_area_name(AreaID id)
 
 std::vector<Coord> Datastructures::get_area_coords(AreaID id)
 {
+    STATS_OPERATION(GET_AREA_COORDS);
     auto area = id_areastructure_.find(id);
     if ( area == id_areastructure_.end()){
         return {NO_COORD};
@@ -124,18 +261,88 @@ std::vector<Coord> Datastructures::get_area_coords(AreaID id)
     return result;
 }
 
+ListView<Coord> Datastructures::get_area_coords_view(AreaID id)
+{
+    STATS_OPERATION(GET_AREA_COORDS);
+    static Coord const not_found[] = {NO_COORD};
+    auto area = id_areastructure_.find(id);
+    if (area == id_areastructure_.end())
+    {
+        return {not_found, 1, generation()};
+    }
+    return {area->second->coordinates, generation()};
+}
+
 void Datastructures::creation_finished()
 {
-    // Replace this comment with your implementation
-    // NOTE!! It's quite ok to leave this empty, if you don't need operations
-    // that are performed after all additions have been done.
+    STATS_OPERATION(CREATION_FINISHED);
+    compact_places();
+}
+
+void Datastructures::compact_places()
+{
+    std::vector<std::pair<std::uint64_t, Place const*>> order;
+    order.reserve(id_datastructure_.size());
+    for (auto& [id, place] : id_datastructure_)
+    {
+        order.push_back({morton_code(place->coordinate), place.get()});
+    }
+    std::sort(order.begin(), order.end(), [](auto const& p1, auto const& p2)
+              { return p1.first < p2.first || (p1.first == p2.first && p1.second->id < p2.second->id); });
+
+    auto storage = std::make_shared<std::vector<Place>>();
+    storage->reserve(order.size());
+    for (auto& [code, place] : order) { storage->push_back(*place); }
+    compacted_places_ = storage->data();
+    compacted_count_ = storage->size();
+    compacted_removed_ = 0;
+
+    invalidate_order_trees(); // They point to the old places
+    // The indexes are filled in the same order, so that their nodes are allocated
+    // in Z-order too. The areas refer to places by id, so they are not affected.
+    id_datastructure_.clear();
+    name_datastructure_.clear();
+    type_datastructure_.clear();
+    id_datastructure_.reserve(storage->size());
+    name_datastructure_.reserve(storage->size());
+    type_datastructure_.reserve(storage->size());
+    for (auto& place : *storage)
+    {
+        std::shared_ptr<Place> pointer(storage, &place); // Shares the ownership of the whole storage
+        id_datastructure_.insert({place.id, pointer});
+        name_datastructure_.insert({place.name, pointer});
+        type_datastructure_.insert({place.type, pointer});
+    }
+}
+
+bool Datastructures::count_removed_place(Place const* place)
+{
+    std::less<Place const*> before;
+    if (before(place, compacted_places_) || !before(place, compacted_places_ + compacted_count_)) { return false; }
+    ++compacted_removed_;
+    return compacted_removed_ * 2 > compacted_count_;
 }
 
 
 std::vector<PlaceID> Datastructures::places_alphabetically()
+{
+    STATS_OPERATION(PLACES_ALPHABETICALLY);
+    update_name_order();
+    return name_ordered_places_;
+}
+
+ListView<PlaceID> Datastructures::places_alphabetically_view()
+{
+    STATS_OPERATION(PLACES_ALPHABETICALLY);
+    update_name_order();
+    return {name_ordered_places_, generation()};
+}
+
+void Datastructures::update_name_order()
 {
     if ( name_changed_)
     {
+        STATS_EVENT(name_cache_rebuilds);
         std::multimap<Name, std::shared_ptr<Place>> map_of_names;
         name_ordered_places_ = {};
         for( auto iter = id_datastructure_.begin(); iter != id_datastructure_.end(); ++iter )
@@ -148,14 +355,32 @@ std::vector<PlaceID> Datastructures::places_alphabetically()
             name_ordered_places_.push_back(iter->second->id);
         }
     }
+    else
+    {
+        STATS_EVENT(name_cache_hits);
+    }
     name_changed_ = false;
-    return name_ordered_places_;
 }
 
 std::vector<PlaceID> Datastructures::places_coord_order()
+{
+    STATS_OPERATION(PLACES_COORD_ORDER);
+    update_coord_order();
+    return coord_ordered_places_;
+}
+
+ListView<PlaceID> Datastructures::places_coord_order_view()
+{
+    STATS_OPERATION(PLACES_COORD_ORDER);
+    update_coord_order();
+    return {coord_ordered_places_, generation()};
+}
+
+void Datastructures::update_coord_order()
 {
     if ( coord_changed_)
     {
+        STATS_EVENT(coord_cache_rebuilds);
         std::multimap<Coord, std::shared_ptr<Place>> map_of_names;
         coord_ordered_places_ = {};
         for( auto iter = id_datastructure_.begin(); iter != id_datastructure_.end(); ++iter )
@@ -168,12 +393,68 @@ std::vector<PlaceID> Datastructures::places_coord_order()
             coord_ordered_places_.push_back(iter->second->id);
         }
     }
+    else
+    {
+        STATS_EVENT(coord_cache_hits);
+    }
     coord_changed_ = false;
-    return coord_ordered_places_;
+}
+
+std::vector<PlaceID> Datastructures::places_alphabetically(std::size_t offset, std::size_t limit)
+{
+    STATS_OPERATION(PLACES_ALPHABETICALLY_PAGE);
+    update_name_tree();
+    std::vector<PlaceID> result;
+    result.reserve(std::min(limit, name_tree_.size() - std::min(offset, name_tree_.size())));
+    name_tree_.for_range(offset, limit, [&result](Place const* place){ result.push_back(place->id); });
+    return result;
+}
+
+std::vector<PlaceID> Datastructures::places_coord_order(std::size_t offset, std::size_t limit)
+{
+    STATS_OPERATION(PLACES_COORD_ORDER_PAGE);
+    update_coord_tree();
+    std::vector<PlaceID> result;
+    result.reserve(std::min(limit, coord_tree_.size() - std::min(offset, coord_tree_.size())));
+    coord_tree_.for_range(offset, limit, [&result](Place const* place){ result.push_back(place->id); });
+    return result;
+}
+
+void Datastructures::update_name_tree()
+{
+    if (name_tree_valid_) { return; }
+
+    std::vector<Place const*> places;
+    places.reserve(id_datastructure_.size());
+    for (auto& [id, place] : id_datastructure_) { places.push_back(place.get()); }
+    std::sort(places.begin(), places.end(), PlaceNameLess());
+    name_tree_.assign_sorted(places);
+    name_tree_valid_ = true;
+}
+
+void Datastructures::update_coord_tree()
+{
+    if (coord_tree_valid_) { return; }
+
+    std::vector<Place const*> places;
+    places.reserve(id_datastructure_.size());
+    for (auto& [id, place] : id_datastructure_) { places.push_back(place.get()); }
+    std::sort(places.begin(), places.end(), PlaceCoordLess());
+    coord_tree_.assign_sorted(places);
+    coord_tree_valid_ = true;
+}
+
+void Datastructures::invalidate_order_trees()
+{
+    name_tree_valid_ = false;
+    coord_tree_valid_ = false;
+    name_tree_.clear();
+    coord_tree_.clear();
 }
 
 std::vector<PlaceID> Datastructures::find_places_name(Name const& name)
 {
+    STATS_OPERATION(FIND_PLACES_NAME);
     std::vector<PlaceID> result;
     auto iterators = name_datastructure_.equal_range(name);
     for( auto iter = iterators.first; iter != iterators.second; ++iter )
@@ -185,6 +466,7 @@ std::vector<PlaceID> Datastructures::find_places_name(Name const& name)
 
 std::vector<PlaceID> Datastructures::find_places_type(PlaceType type)
 {
+    STATS_OPERATION(FIND_PLACES_TYPE);
     std::vector<PlaceID> result;
     auto iterators = type_datastructure_.equal_range(type);
     for( auto iter = iterators.first; iter != iterators.second; ++iter )
@@ -196,12 +478,14 @@ std::vector<PlaceID> Datastructures::find_places_type(PlaceType type)
 
 bool Datastructures::change_place_name(PlaceID id, const Name& newname)
 {
+    STATS_OPERATION(CHANGE_PLACE_NAME);
     auto place = id_datastructure_.find(id);
     if ( place == id_datastructure_.end())
     {
         return false;
 
     }
+    if (name_tree_valid_) { name_tree_.erase(place->second.get()); }
     auto iterator = name_datastructure_.equal_range(place->second->name);
     for ( auto iter = iterator.first; iter != iterator.second; ++iter)
     {
@@ -214,12 +498,15 @@ bool Datastructures::change_place_name(PlaceID id, const Name& newname)
         }
     }
     place->second->name = newname;
+    if (name_tree_valid_) { name_tree_.insert(place->second.get()); }
     name_changed_ = true;
+    change_feed_->publish({ChangeEvent::Type::PLACE_RENAMED, id});
     return true;
 }
 
 bool Datastructures::change_place_coord(PlaceID id, Coord newcoord)
 {
+    STATS_OPERATION(CHANGE_PLACE_COORD);
     auto place = id_datastructure_.find(id);
     if ( place == id_datastructure_.end())
     {
@@ -227,14 +514,20 @@ bool Datastructures::change_place_coord(PlaceID id, Coord newcoord)
 
     } else
     {
+        if (coord_tree_valid_) { coord_tree_.erase(place->second.get()); }
         place->second->coordinate = newcoord;
+        if (coord_tree_valid_) { coord_tree_.insert(place->second.get()); }
+        update_place_area(*place->second);
     }
     coord_changed_ = true;
+    spatial_changed_ = true;
+    change_feed_->publish({ChangeEvent::Type::PLACE_MOVED, id, 0, newcoord});
     return true;
 }
 
 std::vector<AreaID> Datastructures::all_areas()
 {
+    STATS_OPERATION(ALL_AREAS);
     std::vector<AreaID> result {};
     for( auto iter = id_areastructure_.begin(); iter != id_areastructure_.end(); ++iter )
     {
@@ -243,8 +536,22 @@ std::vector<AreaID> Datastructures::all_areas()
     return result;
 }
 
+ListView<AreaID> Datastructures::all_areas_view()
+{
+    STATS_OPERATION(ALL_AREAS);
+    if (area_ids_changed_)
+    {
+        area_ids_.clear();
+        area_ids_.reserve(id_areastructure_.size());
+        for (auto& [id, area] : id_areastructure_) { area_ids_.push_back(id); }
+        area_ids_changed_ = false;
+    }
+    return {area_ids_, generation()};
+}
+
 bool Datastructures::add_subarea_to_area(AreaID id, AreaID parentid)
 {
+    STATS_OPERATION(ADD_SUBAREA_TO_AREA);
     auto area = id_areastructure_.find(id);
     auto parent_area = id_areastructure_.find(parentid);
     if ( (area == id_areastructure_.end()) || (parent_area == id_areastructure_.end()) || (area->second->parent != nullptr) )
@@ -253,11 +560,17 @@ bool Datastructures::add_subarea_to_area(AreaID id, AreaID parentid)
     }
     area->second->parent = parent_area->second;
     parent_area->second->children.push_back(area->second);
+    if (!membership_changed_)
+    {
+        add_type_counts(parent_area->second.get(), area->second->type_counts);
+    }
+    change_feed_->publish({ChangeEvent::Type::SUBAREA_LINKED, id, parentid});
     return true;
 }
 
 std::vector<AreaID> Datastructures::subarea_in_areas(AreaID id)
 {
+    STATS_OPERATION(SUBAREA_IN_AREAS);
     auto iter = id_areastructure_.find(id);
     auto area = iter->second;
     if ( iter == id_areastructure_.end() )
@@ -276,6 +589,7 @@ std::vector<AreaID> Datastructures::subarea_in_areas(AreaID id)
 
 std::vector<PlaceID> Datastructures::places_closest_to(Coord xy, PlaceType type)
 {
+    STATS_OPERATION(PLACES_CLOSEST_TO);
     std::pair<double, std::shared_ptr<Place>> first = {NO_DISTANCE, nullptr};
     std::pair<double, std::shared_ptr<Place>> second = {NO_DISTANCE, nullptr};
     std::pair<double, std::shared_ptr<Place>> third = {NO_DISTANCE, nullptr};
@@ -339,12 +653,14 @@ std::vector<PlaceID> Datastructures::places_closest_to(Coord xy, PlaceType type)
 
 bool Datastructures::remove_place(PlaceID id)
 {
+    STATS_OPERATION(REMOVE_PLACE);
     auto place = id_datastructure_.find(id);
     if ( place == id_datastructure_.end())
     {
         return false;
     }
     coord_changed_ = true;
+    spatial_changed_ = true;
     name_changed_ = true;
     auto iter = name_datastructure_.equal_range(place->second->name);
     for (auto it = iter.first; it != iter.second; ++it)
@@ -364,12 +680,20 @@ bool Datastructures::remove_place(PlaceID id)
             break;
         }
     }
+    remove_place_area(*place->second);
+    if (name_tree_valid_) { name_tree_.erase(place->second.get()); }
+    if (coord_tree_valid_) { coord_tree_.erase(place->second.get()); }
+    bool recompact = count_removed_place(place->second.get());
     id_datastructure_.erase(id);
+    place_ids_changed_ = true;
+    change_feed_->publish({ChangeEvent::Type::PLACE_REMOVED, id});
+    if (recompact) { compact_places(); }
     return true;
 }
 
 std::vector<AreaID> Datastructures::all_subareas_in_area(AreaID id)
 {
+    STATS_OPERATION(ALL_SUBAREAS_IN_AREA);
     auto iter = id_areastructure_.find(id);
     if ( iter == id_areastructure_.end())
     {
@@ -383,6 +707,7 @@ std::vector<AreaID> Datastructures::all_subareas_in_area(AreaID id)
 
 AreaID Datastructures::common_area_of_subareas(AreaID id1, AreaID id2)
 {
+    STATS_OPERATION(COMMON_AREA_OF_SUBAREAS);
     auto area1 = id_areastructure_.find(id1);
     auto area2 = id_areastructure_.find(id2);
     if ( area1 == id_areastructure_.end() || area2 == id_areastructure_.end())
@@ -427,6 +752,812 @@ std::vector<AreaID> Datastructures::get_children(std::shared_ptr<Area> Area)
     return result;
 }
 
+std::vector<PlaceID> Datastructures::places_in_rect(Coord min, Coord max)
+{
+    STATS_OPERATION(PLACES_IN_RECT);
+    update_spatial_index();
+
+    std::vector<PlaceID> result;
+    auto iter = std::lower_bound(x_ordered_places_.begin(), x_ordered_places_.end(), min.x,
+                                 [](auto const& place, int x){ return place.first.x < x; });
+    for ( ; iter != x_ordered_places_.end() && iter->first.x <= max.x; ++iter)
+    {
+        if (iter->first.y >= min.y && iter->first.y <= max.y)
+        {
+            result.push_back(iter->second);
+        }
+    }
+    return result;
+}
+
+std::vector<int> Datastructures::place_density(Coord min, Coord max, int columns, int rows)
+{
+    STATS_OPERATION(PLACE_DENSITY);
+    if (columns <= 0 || rows <= 0) { return {}; }
+    update_spatial_index();
+
+    std::vector<int> result(static_cast<std::size_t>(columns) * rows, 0);
+
+    double column_width = (static_cast<double>(max.x) - min.x + 1) / columns;
+    double row_height = (static_cast<double>(max.y) - min.y + 1) / rows;
+    auto iter = std::lower_bound(x_ordered_places_.begin(), x_ordered_places_.end(), min.x,
+                                 [](auto const& place, int x){ return place.first.x < x; });
+    for ( ; iter != x_ordered_places_.end() && iter->first.x <= max.x; ++iter)
+    {
+        auto xy = iter->first;
+        if (xy.y >= min.y && xy.y <= max.y)
+        {
+            auto column = std::min(columns-1, static_cast<int>((static_cast<double>(xy.x) - min.x) / column_width));
+            auto row = std::min(rows-1, static_cast<int>((static_cast<double>(xy.y) - min.y) / row_height));
+            ++result[static_cast<std::size_t>(row) * columns + column];
+        }
+    }
+    return result;
+}
+
+std::vector<AreaID> Datastructures::areas_in_rect(Coord min, Coord max)
+{
+    STATS_OPERATION(AREAS_IN_RECT);
+    update_area_index();
+
+    std::vector<AreaID> result;
+    search_area_index(min, max, [this, &result](std::size_t i){ result.push_back(area_rtree_areas_[i]->id); });
+    return result;
+}
+
+std::vector<AreaID> Datastructures::areas_containing(Coord xy)
+{
+    STATS_OPERATION(AREAS_CONTAINING);
+    update_area_index();
+
+    std::vector<AreaID> result;
+    search_area_index(xy, xy, [this, &result, xy](std::size_t i)
+    {
+        auto area = area_rtree_areas_[i];
+        if (polygon_contains(area->coordinates, xy)) { result.push_back(area->id); }
+    });
+    return result;
+}
+
+std::pair<Coord, Coord> Datastructures::bounding_box()
+{
+    STATS_OPERATION(BOUNDING_BOX);
+    update_spatial_index();
+    return bounding_box_;
+}
+
+void Datastructures::update_spatial_index()
+{
+    if (!spatial_changed_) { return; }
+
+    x_ordered_places_.clear();
+    x_ordered_places_.reserve(id_datastructure_.size());
+    for (auto& [id, place] : id_datastructure_)
+    {
+        x_ordered_places_.push_back({place->coordinate, id});
+    }
+    std::sort(x_ordered_places_.begin(), x_ordered_places_.end(),
+              [](auto const& p1, auto const& p2){ return p1.first.x < p2.first.x; });
+    update_bounding_box();
+
+    spatial_changed_ = false;
+}
+
+void Datastructures::update_bounding_box()
+{
+    Coord min = {std::numeric_limits<int>::max(), std::numeric_limits<int>::max()};
+    Coord max = {std::numeric_limits<int>::min(), std::numeric_limits<int>::min()};
+    auto extend = [&min, &max](Coord xy)
+    {
+        min = {std::min(min.x, xy.x), std::min(min.y, xy.y)};
+        max = {std::max(max.x, xy.x), std::max(max.y, xy.y)};
+    };
+    for (auto& place : x_ordered_places_) { extend(place.first); }
+    for (auto& area : id_areastructure_)
+    {
+        for (auto xy : area.second->coordinates) { extend(xy); }
+    }
+    bounding_box_ = (min.x <= max.x) ? std::make_pair(min, max) : std::make_pair(NO_COORD, NO_COORD);
+}
+
+std::size_t Datastructures::apply_batch(std::vector<Mutation> const& mutations)
+{
+    STATS_OPERATION(APPLY_BATCH);
+    using Type = Mutation::Type;
+    // Indexes that have to be updated for a place
+    unsigned int const NAME = 1, COORD = 2, EXISTENCE = 4;
+    struct PlaceChange
+    {
+        bool exists; // After the mutations so far
+        unsigned int indexes = 0;
+    };
+
+    // Check each mutation against the places as the earlier mutations leave them
+    std::unordered_map<PlaceID, PlaceChange> changes;
+    changes.reserve(mutations.size());
+    for (std::size_t i = 0; i < mutations.size(); ++i)
+    {
+        auto const& mutation = mutations[i];
+        auto change = changes.find(mutation.id);
+        if (change == changes.end())
+        {
+            change = changes.insert({mutation.id, {id_datastructure_.count(mutation.id) > 0}}).first;
+        }
+        if (change->second.exists == (mutation.type == Type::ADD_PLACE)) { return i; }
+
+        switch (mutation.type)
+        {
+        case Type::CHANGE_PLACE_NAME:
+            change->second.indexes |= NAME;
+            break;
+        case Type::CHANGE_PLACE_COORD:
+            change->second.indexes |= COORD;
+            break;
+        default:
+            change->second.indexes |= NAME | COORD | EXISTENCE;
+        }
+        change->second.exists = (mutation.type != Type::REMOVE_PLACE);
+    }
+
+    // When a large part of the places change, the hashed indexes are rebuilt instead
+    // of updated place by place. Otherwise the changed places are taken out of them
+    // while they still have the old keys.
+    bool rebuild = changes.size() > id_datastructure_.size() / 8;
+    if (rebuild) { invalidate_order_trees(); }
+    auto erase_place = [](auto& index, auto const& key, PlaceID id)
+    {
+        auto range = index.equal_range(key);
+        for (auto iter = range.first; iter != range.second; ++iter)
+        {
+            if (iter->second->id == id)
+            {
+                index.erase(iter);
+                break;
+            }
+        }
+    };
+    for (auto const& [id, change] : changes)
+    {
+        auto place = id_datastructure_.find(id);
+        if (rebuild || place == id_datastructure_.end()) { continue; }
+        if (change.indexes & NAME)
+        {
+            erase_place(name_datastructure_, place->second->name, id);
+            if (name_tree_valid_) { name_tree_.erase(place->second.get()); }
+        }
+        if (change.indexes & EXISTENCE) { erase_place(type_datastructure_, place->second->type, id); }
+        if ((change.indexes & COORD) && coord_tree_valid_) { coord_tree_.erase(place->second.get()); }
+    }
+
+    bool recompact = false; // Too many removed places in the compacted vector
+    for (auto const& mutation : mutations)
+    {
+        switch (mutation.type)
+        {
+        case Type::ADD_PLACE:
+            id_datastructure_[mutation.id] = std::make_shared<Place>(mutation.id, mutation.name, mutation.placetype, mutation.xy);
+            place_ids_changed_ = true;
+            change_feed_->publish({ChangeEvent::Type::PLACE_ADDED, mutation.id, 0, mutation.xy});
+            break;
+        case Type::CHANGE_PLACE_NAME:
+            id_datastructure_.at(mutation.id)->name = mutation.name;
+            change_feed_->publish({ChangeEvent::Type::PLACE_RENAMED, mutation.id});
+            break;
+        case Type::CHANGE_PLACE_COORD:
+            id_datastructure_.at(mutation.id)->coordinate = mutation.xy;
+            change_feed_->publish({ChangeEvent::Type::PLACE_MOVED, mutation.id, 0, mutation.xy});
+            break;
+        case Type::REMOVE_PLACE:
+        {
+            auto place = id_datastructure_.find(mutation.id);
+            remove_place_area(*place->second);
+            recompact = count_removed_place(place->second.get()) || recompact;
+            id_datastructure_.erase(place);
+            place_ids_changed_ = true;
+            change_feed_->publish({ChangeEvent::Type::PLACE_REMOVED, mutation.id});
+            break;
+        }
+        }
+    }
+
+    // Put the changed places that still exist back with their new keys
+    if (rebuild)
+    {
+        name_datastructure_.clear();
+        type_datastructure_.clear();
+        name_datastructure_.reserve(id_datastructure_.size());
+        type_datastructure_.reserve(id_datastructure_.size());
+        for (auto& [id, place] : id_datastructure_)
+        {
+            name_datastructure_.insert({place->name, place});
+            type_datastructure_.insert({place->type, place});
+        }
+    }
+    std::vector<PlaceID> renamed;
+    std::vector<PlaceID> moved;
+    std::vector<std::pair<Coord, PlaceID>> moved_coords;
+    for (auto const& [id, change] : changes)
+    {
+        if (!change.exists) { continue; }
+        auto& place = id_datastructure_.at(id);
+        if (change.indexes & NAME)
+        {
+            if (!rebuild) { name_datastructure_.insert({place->name, place}); }
+            if (name_tree_valid_) { name_tree_.insert(place.get()); }
+            renamed.push_back(id);
+        }
+        if ((change.indexes & EXISTENCE) && !rebuild) { type_datastructure_.insert({place->type, place}); }
+        if (change.indexes & COORD)
+        {
+            update_place_area(*place);
+            if (coord_tree_valid_) { coord_tree_.insert(place.get()); }
+            moved.push_back(id);
+            moved_coords.push_back({place->coordinate, id});
+        }
+    }
+
+    // Sorted vectors that are up to date are merged, the others are sorted when next needed
+    auto changed = [&changes](unsigned int flags)
+    {
+        return [&changes, flags](PlaceID id)
+        {
+            auto change = changes.find(id);
+            return change != changes.end() && (change->second.indexes & flags) != 0;
+        };
+    };
+    if (!name_changed_)
+    {
+        merge_changed(name_ordered_places_, renamed, changed(NAME),
+                      [this](PlaceID id) { return &id_datastructure_.at(id)->name; },
+                      [](Name const* name1, Name const* name2) { return *name1 < *name2; });
+    }
+    if (!coord_changed_)
+    {
+        merge_changed(coord_ordered_places_, moved, changed(COORD),
+                      [this](PlaceID id) { return id_datastructure_.at(id)->coordinate; },
+                      [](Coord xy1, Coord xy2) { return xy1 < xy2; });
+    }
+    if (!spatial_changed_)
+    {
+        auto moved_place = changed(COORD);
+        merge_changed(x_ordered_places_, moved_coords,
+                      [&moved_place](auto const& place) { return moved_place(place.second); },
+                      [](auto const& place) { return place.first.x; },
+                      [](int x1, int x2) { return x1 < x2; });
+        update_bounding_box();
+    }
+
+    if (recompact) { compact_places(); }
+    return mutations.size();
+}
+
+std::size_t Datastructures::check_batch(std::vector<Mutation> const& mutations)
+{
+    STATS_OPERATION(CHECK_BATCH);
+    // Whether each place exists after the mutations so far
+    std::unordered_map<PlaceID, bool> exists;
+    exists.reserve(mutations.size());
+    for (std::size_t i = 0; i < mutations.size(); ++i)
+    {
+        auto const& mutation = mutations[i];
+        auto place = exists.try_emplace(mutation.id, id_datastructure_.count(mutation.id) > 0).first;
+        if (place->second == (mutation.type == Mutation::Type::ADD_PLACE)) { return i; }
+        place->second = (mutation.type != Mutation::Type::REMOVE_PLACE);
+    }
+    return mutations.size();
+}
+
+int Datastructures::infer_subareas()
+{
+    STATS_OPERATION(INFER_SUBAREAS);
+    update_area_index();
+
+    auto const& areas = area_rtree_areas_;
+    std::vector<Area*> parents(areas.size(), nullptr);
+
+    // Find the smallest containing area of each area. Areas with equal
+    // polygons contain each other, the one with the smaller id is the parent.
+    auto find_parent = [&](std::size_t i)
+    {
+        Area* area = areas[i];
+        if (area->parent) { return; }
+        search_area_index(area->bbox_min, area->bbox_max, [&](std::size_t c)
+        {
+            Area* candidate = areas[c];
+            if (c == i || candidate->bbox_min.x > area->bbox_min.x || candidate->bbox_min.y > area->bbox_min.y
+                    || candidate->bbox_max.x < area->bbox_max.x || candidate->bbox_max.y < area->bbox_max.y)
+            {
+                return;
+            }
+            if (parents[i] && (candidate->size > parents[i]->size
+                               || (candidate->size == parents[i]->size && candidate->id > parents[i]->id)))
+            {
+                return;
+            }
+            if (!polygon_contains(candidate->coordinates, area->coordinates)) { return; }
+            if (candidate->size == area->size && candidate->id > area->id && polygon_contains(area->coordinates, candidate->coordinates))
+            {
+                return;
+            }
+            parents[i] = candidate;
+        });
+    };
+
+    // Divide the areas evenly between threads
+    std::size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    std::size_t chunk = (areas.size() + thread_count - 1) / thread_count;
+    std::vector<std::thread> threads;
+    for (std::size_t begin = 0; begin < areas.size(); begin += chunk)
+    {
+        auto end = std::min(areas.size(), begin + chunk);
+        threads.emplace_back([&find_parent, begin, end](){ for (auto i = begin; i < end; ++i) { find_parent(i); } });
+    }
+    for (auto& thread : threads) { thread.join(); }
+
+    int links = 0;
+    for (std::size_t i = 0; i < areas.size(); ++i)
+    {
+        Area* parent = parents[i];
+        if (!parent) { continue; }
+        // Links added earlier with add_subarea_to_area may not follow the
+        // geometry, don't create a loop with them
+        bool loop = false;
+        for (Area* ancestor = parent; ancestor && !loop; ancestor = ancestor->parent.get())
+        {
+            loop = (ancestor == areas[i]);
+        }
+        if (loop) { continue; }
+
+        auto area = id_areastructure_.at(areas[i]->id);
+        auto parent_area = id_areastructure_.at(parent->id);
+        area->parent = parent_area;
+        parent_area->children.push_back(area);
+        if (!membership_changed_)
+        {
+            add_type_counts(parent_area.get(), area->type_counts);
+        }
+        change_feed_->publish({ChangeEvent::Type::SUBAREA_LINKED, area->id, parent_area->id});
+        ++links;
+    }
+    return links;
+}
+
+std::vector<PlaceID> Datastructures::places_in_area(AreaID id, bool recursive)
+{
+    STATS_OPERATION(PLACES_IN_AREA);
+    auto iter = id_areastructure_.find(id);
+    if (iter == id_areastructure_.end())
+    {
+        return {NO_PLACE};
+    }
+    update_membership();
+
+    std::vector<PlaceID> result;
+    std::vector<Area*> stack = {iter->second.get()};
+    while (!stack.empty())
+    {
+        Area* area = stack.back();
+        stack.pop_back();
+        result.insert(result.end(), area->places.begin(), area->places.end());
+        if (recursive)
+        {
+            for (auto& child : area->children) { stack.push_back(child.lock().get()); }
+        }
+    }
+    return result;
+}
+
+std::vector<AreaID> Datastructures::areas_of_place(PlaceID id)
+{
+    STATS_OPERATION(AREAS_OF_PLACE);
+    auto iter = id_datastructure_.find(id);
+    if (iter == id_datastructure_.end())
+    {
+        return {NO_AREA};
+    }
+    update_membership();
+
+    std::vector<AreaID> result;
+    for (Area* area = iter->second->area; area != nullptr; area = area->parent.get())
+    {
+        result.push_back(area->id);
+    }
+    return result;
+}
+
+PlaceTypeCounts Datastructures::area_stats(AreaID id)
+{
+    STATS_OPERATION(AREA_STATS);
+    auto iter = id_areastructure_.find(id);
+    if (iter == id_areastructure_.end())
+    {
+        PlaceTypeCounts result;
+        result.fill(NO_VALUE);
+        return result;
+    }
+    update_membership();
+    return iter->second->type_counts;
+}
+
+void Datastructures::update_membership()
+{
+    if (!membership_changed_ && added_areas_.empty()) { return; }
+    update_spatial_index();
+
+    // Calls func(place index in x_ordered_places_) for places inside the area,
+    // checking the polygon only for places for which wanted(index) is true
+    auto for_places_in = [this](Area* area, auto wanted, auto func)
+    {
+        auto first = std::lower_bound(x_ordered_places_.begin(), x_ordered_places_.end(), area->bbox_min.x,
+                                      [](auto const& place, int x){ return place.first.x < x; });
+        for (auto iter = first; iter != x_ordered_places_.end() && iter->first.x <= area->bbox_max.x; ++iter)
+        {
+            auto xy = iter->first;
+            auto i = static_cast<std::size_t>(iter - x_ordered_places_.begin());
+            if (xy.y >= area->bbox_min.y && xy.y <= area->bbox_max.y && wanted(i) && polygon_contains(area->coordinates, xy))
+            {
+                func(i);
+            }
+        }
+    };
+
+    if (!membership_changed_)
+    {
+        // Only the new areas can change the innermost areas of places
+        for (Area* area : added_areas_)
+        {
+            for_places_in(area, [](std::size_t){ return true; }, [this, area](std::size_t i)
+            {
+                auto& place = *id_datastructure_.at(x_ordered_places_[i].second);
+                if (place.area == nullptr || inner_area(area, place.area))
+                {
+                    remove_place_area(place);
+                    area->places.insert(place.id);
+                    place.area = area;
+                    add_type_count(area, place.type, 1);
+                }
+            });
+        }
+        added_areas_.clear();
+        return;
+    }
+
+    // When the areas are gone through from the innermost, the first area
+    // containing a place is its innermost area
+    std::vector<Area*> areas;
+    for (auto& [id, area] : id_areastructure_)
+    {
+        area->places.clear();
+        area->type_counts = {};
+        areas.push_back(area.get());
+    }
+    std::sort(areas.begin(), areas.end(), inner_area);
+
+    std::vector<Area*> innermost(x_ordered_places_.size(), nullptr);
+    for (Area* area : areas)
+    {
+        for_places_in(area, [&innermost](std::size_t i){ return innermost[i] == nullptr; },
+                      [&innermost, area](std::size_t i){ innermost[i] = area; });
+    }
+
+    for (std::size_t i = 0; i < x_ordered_places_.size(); ++i)
+    {
+        auto& place = *id_datastructure_.at(x_ordered_places_[i].second);
+        place.area = innermost[i];
+        if (place.area)
+        {
+            place.area->places.insert(place.id);
+            add_type_count(place.area, place.type, 1);
+        }
+    }
+    membership_changed_ = false;
+    added_areas_.clear();
+}
+
+void Datastructures::update_place_area(Place& place)
+{
+    // Skipped if the whole membership will be recalculated anyway
+    if (membership_changed_) { return; }
+    update_area_index();
+
+    Area* innermost = nullptr;
+    auto xy = place.coordinate;
+    search_area_index(xy, xy, [this, &innermost, xy](std::size_t i)
+    {
+        Area* area = area_rtree_areas_[i];
+        if ((innermost == nullptr || inner_area(area, innermost)) && polygon_contains(area->coordinates, xy))
+        {
+            innermost = area;
+        }
+    });
+
+    if (innermost != place.area)
+    {
+        remove_place_area(place);
+        if (innermost)
+        {
+            innermost->places.insert(place.id);
+            add_type_count(innermost, place.type, 1);
+        }
+        place.area = innermost;
+    }
+}
+
+void Datastructures::remove_place_area(Place& place)
+{
+    if (place.area)
+    {
+        place.area->places.erase(place.id);
+        add_type_count(place.area, place.type, -1);
+    }
+    place.area = nullptr;
+}
+
+void Datastructures::add_type_counts(Area* area, PlaceTypeCounts const& change)
+{
+    for ( ; area != nullptr; area = area->parent.get())
+    {
+        for (std::size_t i = 0; i < change.size(); ++i) { area->type_counts[i] += change[i]; }
+    }
+}
+
+void Datastructures::add_type_count(Area* area, PlaceType type, int change)
+{
+    for ( ; area != nullptr; area = area->parent.get())
+    {
+        area->type_counts[static_cast<std::size_t>(type)] += change;
+    }
+}
+
+void Datastructures::update_area_index()
+{
+    if (!area_index_changed_) { return; }
+
+    area_rtree_.clear();
+    area_rtree_areas_.clear();
+    for (auto& [id, area] : id_areastructure_)
+    {
+        if (area->coordinates.empty()) { continue; }
+        area_rtree_.push_back({area->bbox_min, area->bbox_max, area_rtree_areas_.size(), 0});
+        area_rtree_areas_.push_back(area.get());
+    }
+
+    // Pack each level to parent nodes until only the root is left. The nodes
+    // of a level can be reordered freely, as long as no parent refers to them.
+    std::size_t level_begin = 0;
+    std::size_t level_end = area_rtree_.size();
+    while (level_end - level_begin > 1)
+    {
+        auto first = area_rtree_.begin() + static_cast<std::ptrdiff_t>(level_begin);
+        auto last = area_rtree_.begin() + static_cast<std::ptrdiff_t>(level_end);
+        auto center_x = [](RTreeNode const& node){ return static_cast<long long int>(node.min.x) + node.max.x; };
+        auto center_y = [](RTreeNode const& node){ return static_cast<long long int>(node.min.y) + node.max.y; };
+
+        // Sort-tile-recursive: vertical slices by x, each slice sorted by y
+        std::size_t count = level_end - level_begin;
+        std::size_t parents = (count + RTREE_NODE_SIZE - 1) / RTREE_NODE_SIZE;
+        std::size_t slices = static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(parents))));
+        std::size_t slice_size = slices * RTREE_NODE_SIZE;
+        std::sort(first, last, [&](RTreeNode const& n1, RTreeNode const& n2){ return center_x(n1) < center_x(n2); });
+        for (std::size_t i = 0; i < count; i += slice_size)
+        {
+            std::sort(first + static_cast<std::ptrdiff_t>(i), first + static_cast<std::ptrdiff_t>(std::min(count, i + slice_size)),
+                      [&](RTreeNode const& n1, RTreeNode const& n2){ return center_y(n1) < center_y(n2); });
+        }
+
+        for (std::size_t i = level_begin; i < level_end; i += RTREE_NODE_SIZE)
+        {
+            RTreeNode parent{area_rtree_[i].min, area_rtree_[i].max, i, std::min(RTREE_NODE_SIZE, level_end - i)};
+            for (std::size_t c = i; c < i + parent.count; ++c)
+            {
+                parent.min = {std::min(parent.min.x, area_rtree_[c].min.x), std::min(parent.min.y, area_rtree_[c].min.y)};
+                parent.max = {std::max(parent.max.x, area_rtree_[c].max.x), std::max(parent.max.y, area_rtree_[c].max.y)};
+            }
+            area_rtree_.push_back(parent);
+        }
+        level_begin = level_end;
+        level_end = area_rtree_.size();
+    }
+
+    area_index_changed_ = false;
+}
+
+template <typename Func>
+void Datastructures::search_area_index(Coord min, Coord max, Func func)
+{
+    if (area_rtree_.empty()) { return; }
+
+    std::vector<std::size_t> stack = {area_rtree_.size() - 1};
+    while (!stack.empty())
+    {
+        auto const& node = area_rtree_[stack.back()];
+        stack.pop_back();
+        if (node.max.x < min.x || node.min.x > max.x || node.max.y < min.y || node.min.y > max.y) { continue; }
+
+        if (node.count == 0)
+        {
+            func(node.first);
+        }
+        else
+        {
+            for (std::size_t c = node.first; c < node.first + node.count; ++c) { stack.push_back(c); }
+        }
+    }
+}
+
+bool Datastructures::stats_enabled()
+{
+#ifdef DATASTRUCTURES_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+char const* Datastructures::operation_name(Operation operation)
+{
+    switch (operation)
+    {
+    case Operation::PLACE_COUNT:
+        return "place_count";
+    case Operation::CLEAR_ALL:
+        return "clear_all";
+    case Operation::ALL_PLACES:
+        return "all_places";
+    case Operation::ADD_PLACE:
+        return "add_place";
+    case Operation::GET_PLACE_NAME_TYPE:
+        return "get_place_name_type";
+    case Operation::GET_PLACE_COORD:
+        return "get_place_coord";
+    case Operation::PLACES_ALPHABETICALLY:
+        return "places_alphabetically";
+    case Operation::PLACES_COORD_ORDER:
+        return "places_coord_order";
+    case Operation::FIND_PLACES_NAME:
+        return "find_places_name";
+    case Operation::FIND_PLACES_TYPE:
+        return "find_places_type";
+    case Operation::CHANGE_PLACE_NAME:
+        return "change_place_name";
+    case Operation::CHANGE_PLACE_COORD:
+        return "change_place_coord";
+    case Operation::ADD_AREA:
+        return "add_area";
+    case Operation::GET_AREA_NAME:
+        return "get_area_name";
+    case Operation::GET_AREA_COORDS:
+        return "get_area_coords";
+    case Operation::ALL_AREAS:
+        return "all_areas";
+    case Operation::ADD_SUBAREA_TO_AREA:
+        return "add_subarea_to_area";
+    case Operation::SUBAREA_IN_AREAS:
+        return "subarea_in_areas";
+    case Operation::CREATION_FINISHED:
+        return "creation_finished";
+    case Operation::ALL_SUBAREAS_IN_AREA:
+        return "all_subareas_in_area";
+    case Operation::PLACES_CLOSEST_TO:
+        return "places_closest_to";
+    case Operation::REMOVE_PLACE:
+        return "remove_place";
+    case Operation::COMMON_AREA_OF_SUBAREAS:
+        return "common_area_of_subareas";
+    case Operation::PLACES_IN_RECT:
+        return "places_in_rect";
+    case Operation::PLACE_DENSITY:
+        return "place_density";
+    case Operation::AREAS_IN_RECT:
+        return "areas_in_rect";
+    case Operation::BOUNDING_BOX:
+        return "bounding_box";
+    case Operation::AREAS_CONTAINING:
+        return "areas_containing";
+    case Operation::INFER_SUBAREAS:
+        return "infer_subareas";
+    case Operation::PLACES_IN_AREA:
+        return "places_in_area";
+    case Operation::AREAS_OF_PLACE:
+        return "areas_of_place";
+    case Operation::AREA_STATS:
+        return "area_stats";
+    case Operation::APPLY_BATCH:
+        return "apply_batch";
+    case Operation::PLACES_ALPHABETICALLY_PAGE:
+        return "places_alphabetically_page";
+    case Operation::PLACES_COORD_ORDER_PAGE:
+        return "places_coord_order_page";
+    case Operation::CHECK_BATCH:
+        return "check_batch";
+    default:
+        return "?";
+    }
+}
+
+bool polygon_contains(std::vector<Coord> const& polygon, Coord xy)
+{
+    // Even-odd rule: count the edges crossing the ray from xy towards +x
+    bool inside = false;
+    for (std::size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++)
+    {
+        Coord a = polygon[j];
+        Coord b = polygon[i];
+        long long int cross = (static_cast<long long int>(b.x) - a.x) * (static_cast<long long int>(xy.y) - a.y)
+                              - (static_cast<long long int>(xy.x) - a.x) * (static_cast<long long int>(b.y) - a.y);
+        if (cross == 0 && xy.x >= std::min(a.x, b.x) && xy.x <= std::max(a.x, b.x)
+                       && xy.y >= std::min(a.y, b.y) && xy.y <= std::max(a.y, b.y))
+        {
+            return true; // On the border
+        }
+        if ((a.y > xy.y) != (b.y > xy.y) && ((b.y > a.y) ? cross > 0 : cross < 0))
+        {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+bool polygon_contains(std::vector<Coord> const& outer, std::vector<Coord> const& inner)
+{
+    for (auto xy : inner)
+    {
+        if (!polygon_contains(outer, xy)) { return false; }
+    }
+
+    // All vertices are inside, but an edge could still cross the border
+    auto side = [](Coord a, Coord b, Coord c)
+    {
+        long long int cross = (static_cast<long long int>(b.x) - a.x) * (static_cast<long long int>(c.y) - a.y)
+                              - (static_cast<long long int>(c.x) - a.x) * (static_cast<long long int>(b.y) - a.y);
+        return (cross > 0) - (cross < 0);
+    };
+    for (std::size_t i = 0, j = inner.size() - 1; i < inner.size(); j = i++)
+    {
+        for (std::size_t k = 0, l = outer.size() - 1; k < outer.size(); l = k++)
+        {
+            if (side(inner[j], inner[i], outer[l]) * side(inner[j], inner[i], outer[k]) < 0
+                    && side(outer[l], outer[k], inner[j]) * side(outer[l], outer[k], inner[i]) < 0)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+double polygon_area(std::vector<Coord> const& polygon)
+{
+    long long int area2 = 0;
+    for (std::size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++)
+    {
+        area2 += static_cast<long long int>(polygon[j].x) * polygon[i].y - static_cast<long long int>(polygon[i].x) * polygon[j].y;
+    }
+    return std::abs(static_cast<double>(area2)) / 2;
+}
+
+namespace
+{
+// Spreads the bits of the value to the even bits of the result
+std::uint64_t spread_bits(std::uint32_t value)
+{
+    std::uint64_t bits = value;
+    bits = (bits | (bits << 16)) & 0x0000ffff0000ffffull;
+    bits = (bits | (bits << 8)) & 0x00ff00ff00ff00ffull;
+    bits = (bits | (bits << 4)) & 0x0f0f0f0f0f0f0f0full;
+    bits = (bits | (bits << 2)) & 0x3333333333333333ull;
+    bits = (bits | (bits << 1)) & 0x5555555555555555ull;
+    return bits;
+}
+}
+
+std::uint64_t morton_code(Coord xy)
+{
+    // Flipping the sign bit orders negative values before positive ones
+    return spread_bits(static_cast<std::uint32_t>(xy.x) ^ 0x80000000u)
+           | (spread_bits(static_cast<std::uint32_t>(xy.y) ^ 0x80000000u) << 1);
+}
+
 double calculate_eucledean(Coord coord)
 {
     return std::sqrt(std::pow(coord.x, 2) + std::pow(coord.y, 2));
@@ -10,11 +10,17 @@
 #include <limits>
 #include <functional>
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
 #include <map>
 #include <math.h>
 #include <deque>
 #include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "listview.hh"
+#include "ordertree.hh"
 
 // Types for IDs
 using PlaceID = long long int;
@@ -38,6 +44,9 @@ Name const NO_NAME = "!!NO_NAME!!";
 // individual values as PlaceType::SHELTER etc.
 enum class PlaceType { OTHER=0, FIREPIT, SHELTER, PARKING, PEAK, BAY, AREA, NO_TYPE };
 
+// Number of places of each type, indexed by PlaceType
+using PlaceTypeCounts = std::array<int, static_cast<std::size_t>(PlaceType::NO_TYPE) + 1>;
+
 // Type for a coordinate (x, y)
 struct Coord
 {
@@ -62,6 +71,8 @@ struct CoordHash
     }
 };
 
+struct Area;
+
 struct Place {
     Place(PlaceID id, Name name, PlaceType type, Coord coordinate):
         id(id),
@@ -73,6 +84,7 @@ struct Place {
     Name name;
     PlaceType type;
     Coord coordinate;
+    Area* area = nullptr; // Innermost area containing the place (see places_in_area)
 };
 
 struct Area {
@@ -82,16 +94,41 @@ struct Area {
         coordinates(coordinates),
         parent(nullptr),
         children({})
-    {}
+    {
+        for (auto xy : this->coordinates)
+        {
+            bbox_min = {std::min(bbox_min.x, xy.x), std::min(bbox_min.y, xy.y)};
+            bbox_max = {std::max(bbox_max.x, xy.x), std::max(bbox_max.y, xy.y)};
+        }
+    }
     AreaID id;
     Name name;
     std::vector<Coord> coordinates;
+    double size = 0; // Area enclosed by the polygon
+    std::unordered_set<PlaceID> places; // Places whose innermost area this is
+    PlaceTypeCounts type_counts = {}; // Places of this area and all its subareas by type
+    // Bounding box of the coordinates (min > max if there are no coordinates)
+    Coord bbox_min = {std::numeric_limits<int>::max(), std::numeric_limits<int>::max()};
+    Coord bbox_max = {std::numeric_limits<int>::min(), std::numeric_limits<int>::min()};
     std::shared_ptr<Area> parent;
     std::vector<std::weak_ptr<Area>> children;
 };
 
 double calculate_eucledean(Coord coord);
 
+// True if the coordinate is inside the polygon or on its border
+bool polygon_contains(std::vector<Coord> const& polygon, Coord xy);
+
+// True if the polygon inner is inside the polygon outer (borders may touch)
+bool polygon_contains(std::vector<Coord> const& outer, std::vector<Coord> const& inner);
+
+// Area enclosed by the polygon (shoelace formula)
+double polygon_area(std::vector<Coord> const& polygon);
+
+// Position of the coordinate on the Z-order (Morton) curve, which interleaves
+// the bits of x and y. Coordinates close to each other mostly get close codes.
+std::uint64_t morton_code(Coord xy);
+
 inline bool operator<(Coord c1, Coord c2)
 {
     double c1_eucledean = calculate_eucledean(c1);
@@ -111,7 +148,22 @@ using Distance = int;
 // Return value for cases where Duration is unknown
 Distance const NO_DISTANCE = NO_VALUE;
 
+class ChangeFeed;
+
+// One change to the places, for Datastructures::apply_batch
+struct Mutation
+{
+    enum class Type { ADD_PLACE, CHANGE_PLACE_NAME, CHANGE_PLACE_COORD, REMOVE_PLACE };
+    Type type;
+    PlaceID id;
+    Name name = NO_NAME; // ADD_PLACE, CHANGE_PLACE_NAME
+    PlaceType placetype = PlaceType::NO_TYPE; // ADD_PLACE
+    Coord xy = NO_COORD; // ADD_PLACE, CHANGE_PLACE_COORD
+};
+
 // This is the class you are supposed to implement
+// (the estimates of performance are worst cases, see operation_complexity for
+// the average growth perftest expects)
 
 class Datastructures
 {
@@ -130,6 +182,11 @@ public:
     // and I loop through all items in id_datastructure causing n in the performance
     std::vector<PlaceID> all_places();
 
+    // The same list without copying (see listview.hh)
+    // Estimate of performance: O(1), O(n) after places are added or removed
+    // Short rationale for estimate: the list is kept in a vector that is refilled when needed
+    ListView<PlaceID> all_places_view();
+
     // Estimate of performance: O(n) average is a constant
     // Short rationale for estimate: Based on cppreference the average case of std::insert
     // is constant but the worst case is linear for an unordered_map
@@ -158,6 +215,22 @@ public:
     // amortized constant
     std::vector<PlaceID> places_coord_order();
 
+    // The two orders above without copying
+    // Estimate of performance: O(1), O(n log n) after changes
+    // Short rationale for estimate: the views refer to the sorted vectors kept for the
+    // functions above
+    ListView<PlaceID> places_alphabetically_view();
+    ListView<PlaceID> places_coord_order_view();
+
+    // Pages of the two orders above: at most limit places starting from position offset
+    // (places with the same name or equally distant coordinates are ordered by id)
+    // Estimate of performance: O(log n + limit), O(n log n) for the first page
+    // Short rationale for estimate: an order-statistic tree finds the position in
+    // O(log n) and is then walked in order. The trees are built on the first call and
+    // updated in O(log n) per added, changed or removed place after that.
+    std::vector<PlaceID> places_alphabetically(std::size_t offset, std::size_t limit);
+    std::vector<PlaceID> places_coord_order(std::size_t offset, std::size_t limit);
+
     // Estimate of performance: O(n) average is amount of same named places
     // Short rationale for estimate: Based on cppreference std::equal_range is on average linear in number
     // of elements with the key, worst case is linear in the size of the container. Push_back is constant
@@ -195,10 +268,20 @@ public:
     // but the worst case is linear std::end is constant
     std::vector<Coord> get_area_coords(AreaID id);
 
+    // The same without copying the coordinates
+    // Estimate of performance: O(1) on average
+    // Short rationale for estimate: the view refers to the coordinates stored in the area
+    ListView<Coord> get_area_coords_view(AreaID id);
+
     // Estimate of performance: O(n)
     // Short rationale for estimate: std::push_back for a vector is constant the loop causes the n
     std::vector<AreaID> all_areas();
 
+    // The same list without copying
+    // Estimate of performance: O(1), O(a) after areas are added
+    // Short rationale for estimate: the list is kept in a vector that is refilled when needed
+    ListView<AreaID> all_areas_view();
+
     // Estimate of performance: O(n) average is a constant
     // Short rationale for estimate:The average case of std::find is constant
     // but the worst case is linear
@@ -211,8 +294,10 @@ public:
 
     // Non-compulsory operations
 
-    // Estimate of performance: Unused O(1)
-    // Short rationale for estimate: Unused
+    // Stores the places again in Z-order of their coordinates (see compact_places)
+    // Estimate of performance: O(n log n)
+    // Short rationale for estimate: the places are sorted by their Z-order code, and
+    // the place indexes are refilled in that order
     void creation_finished();
 
     // Estimate of performance: O(n)
@@ -236,10 +321,201 @@ public:
     // based on cppreference its at most the size of the 2 containers combined
     AreaID common_area_of_subareas(AreaID id1, AreaID id2);
 
+    // Spatial queries (used by the graphical view to draw only the visible part of the map)
+
+    // Estimate of performance: O(log n + k), where k is the number of places with x inside the rectangle
+    // Short rationale for estimate: binary search in places sorted by x, then a linear scan of the
+    // matching x range. Rebuilding the sorted vector after changes is O(n log n).
+    std::vector<PlaceID> places_in_rect(Coord min, Coord max);
+
+    // Number of places in each cell when the rectangle is divided to columns*rows cells.
+    // The result is in row-major order starting from (min.x, min.y), and empty if
+    // columns or rows is not positive.
+    // Estimate of performance: O(log n + k + columns*rows)
+    // Short rationale for estimate: same scan as in places_in_rect, counting instead of collecting
+    std::vector<int> place_density(Coord min, Coord max, int columns, int rows);
+
+    // Estimate of performance: O(log a + k), a = number of areas, k = areas found
+    // Short rationale for estimate: search of the R-tree of area bounding boxes. Rebuilding
+    // the tree after areas are added is O(a log a).
+    std::vector<AreaID> areas_in_rect(Coord min, Coord max);
+
+    // Areas whose polygon contains the coordinate (points on the border count as inside)
+    // Estimate of performance: O(log a + k*c), c = coordinates per area
+    // Short rationale for estimate: the R-tree gives the k areas whose bounding box contains
+    // the coordinate, and the polygon of each is checked in linear time
+    std::vector<AreaID> areas_containing(Coord xy);
+
+    // Makes each area without a parent a subarea of the smallest area whose polygon
+    // contains it. Returns the number of subarea links added.
+    // Estimate of performance: O(a log a + a*k*c^2) / threads, k = areas whose bounding box
+    // contains the area's bounding box
+    // Short rationale for estimate: each area is matched against candidates from the R-tree,
+    // and the containment test compares vertices and edges of the two polygons. The areas
+    // are divided between threads; only the linking at the end is sequential.
+    int infer_subareas();
+
+    // Each place belongs to its innermost area: the smallest area whose polygon contains
+    // the place. The membership is kept up to date when places are added, moved or
+    // removed. New areas are taken into account on the next query.
+
+    // Places whose innermost area is the area, and if recursive, also the places of
+    // all its subareas. {NO_PLACE} if the area is not found.
+    // Estimate of performance: O(k), k = number of places found (+ number of subareas)
+    // Short rationale for estimate: each area stores its places. Taking a new area into
+    // account checks the places in its bounding box, O(p*c).
+    std::vector<PlaceID> places_in_area(AreaID id, bool recursive);
+
+    // Innermost area of the place and the areas it is a subarea of. {NO_AREA} if the place
+    // is not found.
+    // Estimate of performance: O(d), d = depth of the area hierarchy
+    // Short rationale for estimate: the innermost area is stored with the place, the rest
+    // follow the parent links
+    std::vector<AreaID> areas_of_place(PlaceID id);
+
+    // Number of places of each type in the area and all its subareas (the places
+    // places_in_area(id, true) returns). All counts are NO_VALUE if the area is not found.
+    // Estimate of performance: O(1), O(d) per added, moved or removed place
+    // Short rationale for estimate: the counts are kept in each area and updated for the
+    // area of the place and all its ancestors
+    PlaceTypeCounts area_stats(AreaID id);
+
+    // Smallest rectangle containing all places and area coordinates, {NO_COORD, NO_COORD} if none
+    // Estimate of performance: O(1), O(n log n) after changes
+    // Short rationale for estimate: computed when the sorted vector is rebuilt
+    std::pair<Coord, Coord> bounding_box();
+
+    // Applies the mutations in order, with the same result as the corresponding
+    // add_place, change_place_name, change_place_coord and remove_place calls, but
+    // only if all of them are valid: the mutations are checked first, and if one
+    // would fail (unknown place, or an added place that already exists), nothing is
+    // changed. Returns the index of the first invalid mutation, or mutations.size()
+    // if they were all applied.
+    // Estimate of performance: O(n + k log k), k = number of mutations
+    // Short rationale for estimate: the places are changed first, and then each index is
+    // updated once for the k changed places. The sorted vectors are kept valid by
+    // removing the changed places and merging them back in sorted order, instead of
+    // being sorted again on the next query.
+    std::size_t apply_batch(std::vector<Mutation> const& mutations);
+
+    // Checks the mutations like apply_batch, without changing anything. Returns the
+    // index of the first invalid mutation, or mutations.size() if they are all valid.
+    // Estimate of performance: O(k), k = number of mutations
+    // Short rationale for estimate: one hash lookup per mutation
+    std::size_t check_batch(std::vector<Mutation> const& mutations);
+
+    // Events of all successful changes to places, areas and the area hierarchy
+    // (see changefeed.hh)
+    ChangeFeed& change_feed() { return *change_feed_; }
+
+    // Number of changes made so far. The ListViews returned by the functions
+    // above stay valid as long as this does not change.
+    std::uint64_t generation() const;
+
+    // Instrumentation of the operations above: call counts, cumulative time
+    // and use of the sort caches. The statistics are only collected if the
+    // program is compiled with DATASTRUCTURES_STATS defined (qmake CONFIG+=stats),
+    // otherwise they stay zero and cost nothing.
+
+    enum class Operation { PLACE_COUNT, CLEAR_ALL, ALL_PLACES, ADD_PLACE, GET_PLACE_NAME_TYPE, GET_PLACE_COORD,
+                           PLACES_ALPHABETICALLY, PLACES_COORD_ORDER, FIND_PLACES_NAME, FIND_PLACES_TYPE,
+                           CHANGE_PLACE_NAME, CHANGE_PLACE_COORD, ADD_AREA, GET_AREA_NAME, GET_AREA_COORDS,
+                           ALL_AREAS, ADD_SUBAREA_TO_AREA, SUBAREA_IN_AREAS, CREATION_FINISHED,
+                           ALL_SUBAREAS_IN_AREA, PLACES_CLOSEST_TO, REMOVE_PLACE, COMMON_AREA_OF_SUBAREAS,
+                           PLACES_IN_RECT, PLACE_DENSITY, AREAS_IN_RECT, BOUNDING_BOX,
+                           AREAS_CONTAINING, INFER_SUBAREAS, PLACES_IN_AREA, AREAS_OF_PLACE, AREA_STATS,
+                           APPLY_BATCH, PLACES_ALPHABETICALLY_PAGE, PLACES_COORD_ORDER_PAGE, CHECK_BATCH,
+                           OPERATION_COUNT };
+
+    struct OperationStats
+    {
+        unsigned long long int calls = 0;
+        unsigned long long int total_ns = 0;
+    };
+
+    struct Stats
+    {
+        std::array<OperationStats, static_cast<std::size_t>(Operation::OPERATION_COUNT)> operations = {};
+        unsigned long long int name_cache_hits = 0; // places_alphabetically returned the cached order
+        unsigned long long int name_cache_rebuilds = 0; // places_alphabetically had to sort (name_changed_)
+        unsigned long long int coord_cache_hits = 0;
+        unsigned long long int coord_cache_rebuilds = 0;
+    };
+
+    static bool stats_enabled();
+    static char const* operation_name(Operation operation);
+
+    // Expected growth of the average time of one call as the number of places n grows
+    // (there is an area for every 10 places, in a binary hierarchy), e.g. "O(log n)".
+    // The estimates of performance above are mostly worst cases, such as O(n) for a hash
+    // lookup. This is the growth perftest measures, and it warns if a fitted growth is
+    // faster, so an estimate changed above must be changed here too.
+    static constexpr char const* operation_complexity(Operation operation)
+    {
+        switch (operation)
+        {
+        case Operation::PLACE_COUNT: return "O(1)";
+        case Operation::CLEAR_ALL: return "O(n)";
+        case Operation::ALL_PLACES: return "O(n)";
+        case Operation::ADD_PLACE: return "O(log n)"; // Sorted trees and area membership
+        case Operation::GET_PLACE_NAME_TYPE: return "O(1)";
+        case Operation::GET_PLACE_COORD: return "O(1)";
+        case Operation::PLACES_ALPHABETICALLY: return "O(n log n)";
+        case Operation::PLACES_COORD_ORDER: return "O(n log n)";
+        case Operation::FIND_PLACES_NAME: return "O(1)"; // Few places have the same name
+        case Operation::FIND_PLACES_TYPE: return "O(n)"; // n/8 places of each type
+        case Operation::CHANGE_PLACE_NAME: return "O(log n)";
+        case Operation::CHANGE_PLACE_COORD: return "O(log n)";
+        case Operation::ADD_AREA: return "O(1)";
+        case Operation::GET_AREA_NAME: return "O(1)";
+        case Operation::GET_AREA_COORDS: return "O(1)";
+        case Operation::ALL_AREAS: return "O(n)";
+        case Operation::ADD_SUBAREA_TO_AREA: return "O(1)";
+        case Operation::SUBAREA_IN_AREAS: return "O(log n)"; // Depth of the hierarchy
+        case Operation::CREATION_FINISHED: return "O(n log n)";
+        case Operation::ALL_SUBAREAS_IN_AREA: return "O(log n)"; // Average size of a subtree
+        case Operation::PLACES_CLOSEST_TO: return "O(n)";
+        case Operation::REMOVE_PLACE: return "O(n)"; // Scan of the places of the same type
+        case Operation::COMMON_AREA_OF_SUBAREAS: return "O(log n)";
+        case Operation::PLACES_IN_RECT: return "O(n)";
+        case Operation::PLACE_DENSITY: return "O(n)";
+        case Operation::AREAS_IN_RECT: return "O(n)";
+        case Operation::BOUNDING_BOX: return "O(1)";
+        case Operation::AREAS_CONTAINING: return "O(n)"; // Random areas span the map, so k grows with n
+        case Operation::INFER_SUBAREAS: return "O(n^2)";
+        case Operation::PLACES_IN_AREA: return "O(n)"; // Recursive: the areas near the root have most places
+        case Operation::AREAS_OF_PLACE: return "O(log n)";
+        case Operation::AREA_STATS: return "O(1)";
+        case Operation::APPLY_BATCH: return "O(n)";
+        case Operation::PLACES_ALPHABETICALLY_PAGE: return "O(log n)";
+        case Operation::PLACES_COORD_ORDER_PAGE: return "O(log n)";
+        case Operation::CHECK_BATCH: return "O(1)";
+        case Operation::OPERATION_COUNT: break;
+        }
+        return "";
+    }
+    Stats const& stats() const { return stats_; }
+    void reset_stats() { stats_ = {}; } // clear_all() does not reset statistics
+
 private:
     // Estimate of performance: O(n)
     // get_children is linear where in the worst case n is the container size
     std::vector<AreaID> get_children(std::shared_ptr<Area> Area);
+    // Copies the places into one vector in Z-order, and points the place indexes to
+    // the copies. Places near each other are then near each other in memory, which
+    // speeds up the queries that go through many places (places_closest_to, area
+    // membership). Places added later are allocated separately until the next call.
+    // The vector is freed only when none of its places is left, so removed places
+    // keep using memory. When more than half of the places in it have been removed,
+    // the places are compacted again, so that the vector takes at most about twice
+    // the memory of the places still in it.
+    void compact_places();
+    // Counts the removal of a place in the compacted vector. Returns true if the
+    // places should be compacted again.
+    bool count_removed_place(Place const* place);
+    Place const* compacted_places_ = nullptr; // Start of the vector of compact_places
+    std::size_t compacted_count_ = 0; // Places in the vector
+    std::size_t compacted_removed_ = 0; // Places in the vector that have been removed
     std::unordered_map<PlaceID, std::shared_ptr<Place>> id_datastructure_;
     std::unordered_multimap<Name, std::shared_ptr<Place>> name_datastructure_;
     std::unordered_multimap<PlaceType, std::shared_ptr<Place>> type_datastructure_;
@@ -248,6 +524,80 @@ private:
     bool name_changed_;
     std::vector<PlaceID> name_ordered_places_;
     std::vector<PlaceID> coord_ordered_places_;
+    void update_name_order();
+    void update_coord_order();
+    // Ids of all places and areas for the views, refilled when changed
+    bool place_ids_changed_ = true;
+    bool area_ids_changed_ = true;
+    std::vector<PlaceID> place_ids_;
+    std::vector<AreaID> area_ids_;
+    // Places sorted by x coordinate for the spatial queries, rebuilt when spatial_changed_
+    void update_spatial_index();
+    void update_bounding_box();
+    bool spatial_changed_ = true;
+    std::vector<std::pair<Coord, PlaceID>> x_ordered_places_;
+    std::pair<Coord, Coord> bounding_box_ = {NO_COORD, NO_COORD};
+
+    // R-tree of area bounding boxes, bulk loaded (sort-tile-recursive) when
+    // area_index_changed_. The nodes are stored in one vector with the root
+    // last. A node with count 0 is an entry for area areas_[first], other
+    // nodes have count children starting from index first.
+    struct RTreeNode
+    {
+        Coord min;
+        Coord max;
+        std::size_t first;
+        std::size_t count;
+    };
+    void update_area_index();
+    // Calls func(index into area_rtree_areas_) for areas whose bounding box intersects the rectangle
+    template <typename Func>
+    void search_area_index(Coord min, Coord max, Func func);
+    static constexpr std::size_t RTREE_NODE_SIZE = 16;
+    bool area_index_changed_ = true;
+    std::vector<RTreeNode> area_rtree_;
+    std::vector<Area*> area_rtree_areas_;
+
+    // Place to innermost area membership, recalculated for all places when
+    // membership_changed_, otherwise updated place by place. Areas added after
+    // the membership was calculated are applied on the next query.
+    void update_membership();
+    void update_place_area(Place& place);
+    void remove_place_area(Place& place);
+    // Adds change to the counts of the area and its ancestors
+    static void add_type_counts(Area* area, PlaceTypeCounts const& change);
+    static void add_type_count(Area* area, PlaceType type, int change);
+    bool membership_changed_ = true;
+    std::vector<Area*> added_areas_;
+
+    // Order-statistic trees of the places for the paged listings, built when
+    // first needed and then updated with each change until invalidated
+    struct PlaceNameLess
+    {
+        bool operator()(Place const* place1, Place const* place2) const
+        {
+            auto order = place1->name.compare(place2->name);
+            return order < 0 || (order == 0 && place1->id < place2->id);
+        }
+    };
+    struct PlaceCoordLess
+    {
+        bool operator()(Place const* place1, Place const* place2) const
+        {
+            if (place1->coordinate < place2->coordinate) { return true; }
+            if (place2->coordinate < place1->coordinate) { return false; }
+            return place1->id < place2->id;
+        }
+    };
+    void update_name_tree();
+    void update_coord_tree();
+    void invalidate_order_trees();
+    bool name_tree_valid_ = false;
+    bool coord_tree_valid_ = false;
+    OrderTree<Place const*, PlaceNameLess> name_tree_;
+    OrderTree<Place const*, PlaceCoordLess> coord_tree_;
+    Stats stats_;
+    std::unique_ptr<ChangeFeed> change_feed_;
 };
 
 #endif // DATASTRUCTURES_HH
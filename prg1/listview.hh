@@ -0,0 +1,50 @@
+// Listview.hh
+//
+// Read-only view of a list stored inside Datastructures, so that callers can
+// go through it without copying it (like std::span of C++20)
+
+#ifndef LISTVIEW_HH
+#define LISTVIEW_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The view refers to the storage of the data structure, so it is only valid
+// until the data is changed. generation() is the Datastructures::generation()
+// when the view was made; the view is valid as long as they are equal.
+template <typename Item>
+class ListView
+{
+public:
+    using value_type = Item;
+    using const_iterator = Item const*;
+    using iterator = const_iterator;
+
+    ListView() = default;
+    ListView(Item const* data, std::size_t size, std::uint64_t generation) :
+        data_(data), size_(size), generation_(generation)
+    {}
+    ListView(std::vector<Item> const& items, std::uint64_t generation) :
+        data_(items.data()), size_(items.size()), generation_(generation)
+    {}
+
+    const_iterator begin() const { return data_; }
+    const_iterator end() const { return data_ + size_; }
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    Item const& operator[](std::size_t i) const { return data_[i]; }
+    Item const& front() const { return data_[0]; }
+    Item const& back() const { return data_[size_ - 1]; }
+
+    std::uint64_t generation() const { return generation_; }
+
+    std::vector<Item> to_vector() const { return {begin(), end()}; }
+
+private:
+    Item const* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::uint64_t generation_ = 0;
+};
+
+#endif // LISTVIEW_HH
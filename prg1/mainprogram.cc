@@ -30,6 +30,7 @@ using std::ostream;
 
 #include <fstream>
 using std::ifstream;
+using std::ofstream;
 
 #include <sstream>
 using std::istringstream;
@@ -68,6 +69,13 @@ using std::uniform_int_distribution;
 
 #include <chrono>
 
+#include <thread>
+#include <shared_mutex>
+#include <mutex>
+#include <atomic>
+
+#include <filesystem>
+
 #include <functional>
 using std::function;
 using std::equal_to;
@@ -108,6 +116,8 @@ using std::transform;
 #include <iterator>
 using std::back_inserter;
 
+#include <numeric>
+
 #include <cstddef>
 #include <cassert>
 
@@ -116,6 +126,8 @@ using std::back_inserter;
 
 #include "datastructures.hh"
 
+#include "perfstats.hh"
+
 #ifdef GRAPHICAL_GUI
 #include "mainwindow.hh"
 #endif
@@ -141,7 +153,8 @@ MainProgram::CmdResult MainProgram::cmd_add_place(std::ostream& output, MatchIte
     Coord xy = {convert_string_to<int>(xstr), convert_string_to<int>(ystr)};
 
     bool success = ds_.add_place(id, name, type, xy);
-    if (!success) { id = NO_PLACE; }
+    if (success) { record_mutation({TraceOp::ADD_PLACE, id, 0, name, type, xy}); }
+    else { id = NO_PLACE; }
 
     view_dirty = true;
     return {ResultType::PLACEIDLIST, CmdResultPlaceIDs{NO_AREA, {id}}};
@@ -154,6 +167,7 @@ MainProgram::CmdResult MainProgram::cmd_place_name_type(std::ostream &output, Ma
 
     PlaceID placeid = convert_string_to<PlaceID>(placeidstr);
 
+    if (trace_) { trace_->write({TraceOp::GET_PLACE_NAME_TYPE, placeid}); }
     auto [name, type] = ds_.get_place_name_type(placeid);
     if (name == NO_NAME)
     {
@@ -182,6 +196,7 @@ MainProgram::CmdResult MainProgram::cmd_place_coord(std::ostream &output, MainPr
 
     PlaceID placeid = convert_string_to<PlaceID>(placeidstr);
 
+    if (trace_) { trace_->write({TraceOp::GET_PLACE_COORD, placeid}); }
     auto coord = ds_.get_place_coord(placeid);
     if (coord == NO_COORD)
     {
@@ -232,6 +247,7 @@ MainProgram::CmdResult MainProgram::cmd_add_area(std::ostream& output, MainProgr
 
     if (success)
     {
+        record_mutation({TraceOp::ADD_AREA, id, 0, name, PlaceType::NO_TYPE, NO_COORD, NO_COORD, coords});
         view_dirty = true;
         return {ResultType::PLACEIDLIST, CmdResultPlaceIDs{id, {}}};
     }
@@ -249,6 +265,7 @@ MainProgram::CmdResult MainProgram::cmd_area_name(std::ostream &output, MainProg
 
     AreaID id = convert_string_to<AreaID>(idstr);
 
+    if (trace_) { trace_->write({TraceOp::GET_AREA_NAME, id}); }
     auto result = ds_.get_area_name(id);
     if (result == NO_NAME)
     {
@@ -277,7 +294,8 @@ MainProgram::CmdResult MainProgram::cmd_area_coords(std::ostream &output, MainPr
 
     AreaID id = convert_string_to<AreaID>(idstr);
 
-    auto coords = ds_.get_area_coords(id);
+    if (trace_) { trace_->write({TraceOp::GET_AREA_COORDS, id}); }
+    auto coords = ds_.get_area_coords_view(id);
 
     if (coords.empty())
     {
@@ -299,6 +317,7 @@ MainProgram::CmdResult MainProgram::cmd_area_coords(std::ostream &output, MainPr
 
 MainProgram::CmdResult MainProgram::cmd_creation_finished(std::ostream& output, MainProgram::MatchIter /*begin*/, MainProgram::MatchIter /*end*/)
 {
+    if (trace_) { trace_->write({TraceOp::CREATION_FINISHED}); }
     ds_.creation_finished();
     output << "Creation finished.";
 
@@ -314,7 +333,8 @@ MainProgram::CmdResult MainProgram::cmd_change_place_name(std::ostream& /*output
     PlaceID id = convert_string_to<PlaceID>(idstr);
 
     bool success = ds_.change_place_name(id, newname);
-    if (!success) { id = NO_PLACE; }
+    if (success) { record_mutation({TraceOp::CHANGE_PLACE_NAME, id, 0, newname}); }
+    else { id = NO_PLACE; }
 
     view_dirty = true;
     return {ResultType::PLACEIDLIST, CmdResultPlaceIDs{NO_AREA, {id}}};
@@ -343,7 +363,8 @@ MainProgram::CmdResult MainProgram::cmd_change_place_coord(std::ostream& /*outpu
     int y = convert_string_to<int>(ystr);
 
     bool success = ds_.change_place_coord(id, {x, y});
-    if (!success) { id = NO_PLACE; }
+    if (success) { record_mutation({TraceOp::CHANGE_PLACE_COORD, id, 0, {}, PlaceType::NO_TYPE, {x, y}}); }
+    else { id = NO_PLACE; }
 
     view_dirty = true;
     return {ResultType::PLACEIDLIST, CmdResultPlaceIDs{NO_AREA, {id}}};
@@ -374,6 +395,7 @@ MainProgram::CmdResult MainProgram::cmd_add_subarea_to_area(std::ostream& output
     bool ok = ds_.add_subarea_to_area(sourceid, targetid);
     if (ok)
     {
+        record_mutation({TraceOp::ADD_SUBAREA_TO_AREA, sourceid, targetid});
         auto sourcename = ds_.get_area_name(sourceid);
         auto targetname = ds_.get_area_name(targetid);
         output << "Added subarea " << sourcename << " to area " << targetname << endl;
@@ -396,6 +418,7 @@ MainProgram::CmdResult MainProgram::cmd_subarea_in_areas(std::ostream& output, M
     output << "Area hierarchy for area ";
     print_area(id, output);
 
+    if (trace_) { trace_->write({TraceOp::SUBAREA_IN_AREAS, id}); }
     auto result = ds_.subarea_in_areas(id);
     if (result.empty()) { output << "Area is not a subarea of any area." << endl; }
     return {ResultType::AREAIDLIST, result};
@@ -420,6 +443,7 @@ MainProgram::CmdResult MainProgram::cmd_all_subareas_in_area(std::ostream &outpu
     output << "All subareas of ";
     print_area(id, output);
 
+    if (trace_) { trace_->write({TraceOp::ALL_SUBAREAS_IN_AREA, id}); }
     auto result = ds_.all_subareas_in_area(id);
     sort(result.begin(), result.end());
     if (result.empty()) { output << "No subareas found." << endl; }
@@ -449,6 +473,7 @@ MainProgram::CmdResult MainProgram::cmd_places_closest_to(std::ostream& /*output
       type = convert_string_to_placetype(typestr);
   }
 
+  if (trace_) { trace_->write({TraceOp::PLACES_CLOSEST_TO, 0, 0, {}, type, coord}); }
   auto result = ds_.places_closest_to(coord, type);
   return {ResultType::PLACEIDLIST, CmdResultPlaceIDs{NO_AREA, result}};
 }
@@ -464,6 +489,130 @@ void MainProgram::test_places_closest_to()
     }
 }
 
+MainProgram::CmdResult MainProgram::cmd_areas_containing(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string xstr = *begin++;
+    string ystr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    Coord coord = {convert_string_to<int>(xstr), convert_string_to<int>(ystr)};
+
+    if (trace_) { trace_->write({TraceOp::AREAS_CONTAINING, 0, 0, {}, PlaceType::NO_TYPE, coord}); }
+    auto result = ds_.areas_containing(coord);
+    sort(result.begin(), result.end());
+    if (result.empty()) { output << "No areas contain the coordinate." << endl; }
+    return {ResultType::AREAIDLIST, result};
+}
+
+void MainProgram::test_areas_containing()
+{
+    if (random_areas_added_ > 0) // Don't do anything if there's no areas
+    {
+        auto x = random<int>(1, 10000);
+        auto y = random<int>(1, 10000);
+        ds_.areas_containing({x,y});
+    }
+}
+
+MainProgram::CmdResult MainProgram::cmd_places_in_area(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string idstr = *begin++;
+    string recursivestr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    AreaID id = convert_string_to<AreaID>(idstr);
+    bool recursive = !recursivestr.empty();
+
+    if (trace_) { trace_->write({TraceOp::PLACES_IN_AREA, id, recursive}); }
+    auto result = ds_.places_in_area(id, recursive);
+    if (result.size() == 1 && result.front() == NO_PLACE)
+    {
+        return {ResultType::PLACEIDLIST, CmdResultPlaceIDs{NO_AREA, result}};
+    }
+    sort(result.begin(), result.end());
+    if (result.empty()) { output << "No places found." << endl; }
+    return {ResultType::PLACEIDLIST, CmdResultPlaceIDs{id, result}};
+}
+
+void MainProgram::test_places_in_area()
+{
+    if (random_areas_added_ > 0) // Don't do anything if there's no areas
+    {
+        auto id = n_to_areaid(random<decltype(random_areas_added_)>(0, random_areas_added_));
+        ds_.places_in_area(id, true);
+    }
+}
+
+MainProgram::CmdResult MainProgram::cmd_areas_of_place(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string idstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    PlaceID id = convert_string_to<PlaceID>(idstr);
+
+    if (trace_) { trace_->write({TraceOp::AREAS_OF_PLACE, id}); }
+    auto result = ds_.areas_of_place(id);
+    if (result.empty()) { output << "Place is not in any area." << endl; }
+    return {ResultType::AREAIDLIST, result};
+}
+
+void MainProgram::test_areas_of_place()
+{
+    if (random_places_added_ > 0) // Don't do anything if there's no places
+    {
+        auto id = n_to_placeid(random<decltype(random_places_added_)>(0, random_places_added_));
+        ds_.areas_of_place(id);
+    }
+}
+
+MainProgram::CmdResult MainProgram::cmd_area_stats(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string idstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    AreaID id = convert_string_to<AreaID>(idstr);
+
+    if (trace_) { trace_->write({TraceOp::AREA_STATS, id}); }
+    auto counts = ds_.area_stats(id);
+    if (counts.front() == NO_VALUE)
+    {
+        return {ResultType::AREAIDLIST, CmdResultAreaIDs{NO_AREA}};
+    }
+
+    output << "Places in area ";
+    print_area(id, output);
+    int total = 0;
+    for (std::size_t i = 0; i < counts.size(); ++i)
+    {
+        if (counts[i] == 0) { continue; }
+        output << "  " << convert_placetype_to_string(static_cast<PlaceType>(i)) << ": " << counts[i] << endl;
+        total += counts[i];
+    }
+    output << "  total: " << total << endl;
+    return {};
+}
+
+void MainProgram::test_area_stats()
+{
+    if (random_areas_added_ > 0) // Don't do anything if there's no areas
+    {
+        auto id = n_to_areaid(random<decltype(random_areas_added_)>(0, random_areas_added_));
+        ds_.area_stats(id);
+    }
+}
+
+MainProgram::CmdResult MainProgram::cmd_infer_subareas(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    assert( begin == end && "Impossible number of parameters!");
+
+    view_dirty = true;
+
+    record_mutation({TraceOp::INFER_SUBAREAS});
+    auto links = ds_.infer_subareas();
+    output << "Added " << links << " subarea links" << endl;
+    return {};
+}
+
 MainProgram::CmdResult MainProgram::cmd_common_area_of_subareas(std::ostream &output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
 {
     string id1str = *begin++;
@@ -473,6 +622,7 @@ MainProgram::CmdResult MainProgram::cmd_common_area_of_subareas(std::ostream &ou
     AreaID id1 = convert_string_to<PlaceID>(id1str);
     AreaID id2 = convert_string_to<PlaceID>(id2str);
 
+    if (trace_) { trace_->write({TraceOp::COMMON_AREA_OF_SUBAREAS, id1, id2}); }
     auto result = ds_.common_area_of_subareas(id1, id2);
     if (result == NO_AREA)
     {
@@ -504,6 +654,7 @@ MainProgram::CmdResult MainProgram::cmd_remove_place(std::ostream& output, Match
     bool success = ds_.remove_place(id);
     if (success)
     {
+        record_mutation({TraceOp::REMOVE_PLACE, id});
         output << "Place " << name << "(" << convert_placetype_to_string(type) << ") removed." << endl;
         view_dirty = true;
         return {};
@@ -526,7 +677,7 @@ void MainProgram::test_remove_place()
 
 void MainProgram::add_random_places_areas(unsigned int size, Coord min, Coord max)
 {
-    for (unsigned int i = 0; i < size; ++i)
+    for (unsigned int i = 0; i < size && !check_stop(); ++i)
     {
         auto name = n_to_name(random_places_added_);
         PlaceID id = n_to_placeid(random_places_added_);
@@ -535,6 +686,7 @@ void MainProgram::add_random_places_areas(unsigned int size, Coord min, Coord ma
         int x = random<int>(min.x, max.x);
         int y = random<int>(min.y, max.y);
 
+        if (wal_) { wal_->append({TraceOp::ADD_PLACE, id, 0, name, type, {x, y}}); }
         ds_.add_place(id, name, type, {x, y});
 
         // Add a new area for every 10 places
@@ -546,12 +698,14 @@ void MainProgram::add_random_places_areas(unsigned int size, Coord min, Coord ma
             {
                 coords.push_back({random<int>(min.x, max.x),random<int>(min.y, max.y)});
             }
+            if (wal_) { wal_->append({TraceOp::ADD_AREA, areaid, 0, convert_to_string(areaid), PlaceType::NO_TYPE, NO_COORD, NO_COORD, coords}); }
             ds_.add_area(areaid, convert_to_string(areaid), std::move(coords));
             // Add area as subarea so that we get a binary tree
             if (random_areas_added_ > 0)
             {
 //                auto parentid = random<decltype(random_areas_added_)>(0, random_areas_added_);
                 auto parentid = n_to_areaid(random_areas_added_ / 2);
+                if (wal_) { wal_->append({TraceOp::ADD_SUBAREA_TO_AREA, areaid, parentid}); }
                 ds_.add_subarea_to_area(areaid, parentid);
             }
             ++random_areas_added_;
@@ -585,7 +739,7 @@ MainProgram::CmdResult MainProgram::cmd_random_add(std::ostream& output, MatchIt
     }
     else
     {
-        auto places = ds_.all_places();
+        auto places = ds_.all_places_view();
         if (!places.empty())
         {
             // Find out bounding box
@@ -608,9 +762,17 @@ MainProgram::CmdResult MainProgram::cmd_random_add(std::ostream& output, MatchIt
         max = def_max;
     }
 
+    if (trace_) { trace_->write({TraceOp::RANDOM_ADD, size, 0, {}, PlaceType::NO_TYPE, min, max}); }
     add_random_places_areas(size, min, max);
 
-    output << "Added: " << size << " places." << endl;
+    if (check_stop())
+    {
+        output << "Stopped!" << endl;
+    }
+    else
+    {
+        output << "Added: " << size << " places." << endl;
+    }
 
     view_dirty = true;
 
@@ -629,6 +791,7 @@ MainProgram::CmdResult MainProgram::cmd_randseed(std::ostream& output, MatchIter
 
     unsigned long int seed = convert_string_to<unsigned long int>(seedstr);
 
+    if (trace_) { trace_->write({TraceOp::RANDOM_SEED, static_cast<long long int>(seed)}); }
     rand_engine_.seed(seed);
     init_primes();
 
@@ -782,10 +945,273 @@ MainProgram::CmdResult MainProgram::cmd_testread(std::ostream& output, MatchIter
     return {};
 }
 
+namespace
+{
+
+// Matches a filename against a pattern with wildcards * and ?
+bool wildcard_match(string const& pattern, string const& name)
+{
+    std::size_t p = 0;
+    std::size_t n = 0;
+    std::size_t star = string::npos; // Position of the last * seen in pattern
+    std::size_t star_n = 0;          // Position in name matched by that *
+    while (n < name.size())
+    {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n]))
+        {
+            ++p; ++n;
+        }
+        else if (p < pattern.size() && pattern[p] == '*')
+        {
+            star = p++;
+            star_n = n;
+        }
+        else if (star != string::npos)
+        {
+            p = star + 1;
+            n = ++star_n;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') { ++p; }
+    return p == pattern.size();
+}
+
+// Output stream buffer that compares each line written to it with the next
+// line of the expected output as soon as the line is complete, remembering
+// only the first difference
+class LineComparator : public std::streambuf
+{
+public:
+    explicit LineComparator(std::istream& expected) : expected_(expected) {}
+
+    // Compares a last line without newline, and checks that the expected
+    // output has no more lines. Returns true if no differences were found.
+    bool finish()
+    {
+        if (!line_.empty()) { compare_line(); }
+        string expected_line;
+        if (!different_ && getline(expected_, expected_line))
+        {
+            ++lines_;
+            set_difference("<end of output>", expected_line);
+        }
+        return !different_;
+    }
+
+    unsigned int lines() const { return lines_; } // Lines compared
+    string const& actual() const { return actual_; } // First differing lines
+    string const& expected() const { return expected_line_; }
+
+protected:
+    int_type overflow(int_type ch) override
+    {
+        if (traits_type::eq_int_type(ch, traits_type::eof())) { return traits_type::not_eof(ch); }
+        char c = traits_type::to_char_type(ch);
+        xsputn(&c, 1);
+        return ch;
+    }
+
+    std::streamsize xsputn(char const* chars, std::streamsize count) override
+    {
+        for (std::streamsize i = 0; i < count && !different_; ++i)
+        {
+            if (chars[i] == '\n') { compare_line(); }
+            else { line_ += chars[i]; }
+        }
+        return count;
+    }
+
+private:
+    void compare_line()
+    {
+        ++lines_;
+        string expected_line;
+        if (!getline(expected_, expected_line)) { set_difference(line_, "<end of output>"); }
+        else if (expected_line != line_) { set_difference(line_, expected_line); }
+        line_.clear();
+    }
+
+    void set_difference(string const& actual, string const& expected)
+    {
+        different_ = true;
+        actual_ = actual;
+        expected_line_ = expected;
+    }
+
+    std::istream& expected_;
+    string line_; // Current line, not yet complete
+    unsigned int lines_ = 0;
+    bool different_ = false;
+    string actual_;
+    string expected_line_;
+};
+
+}
+
+MainProgram::CmdResult MainProgram::cmd_testread_all(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string pattern = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    namespace fs = std::filesystem;
+
+    // Collect the input files matching the pattern, and their expected output files
+    fs::path patternpath(pattern);
+    fs::path dir = patternpath.has_parent_path() ? patternpath.parent_path() : fs::path(".");
+    string namepattern = patternpath.filename().string();
+
+    vector<pair<string, string>> files;
+    std::error_code ec;
+    for (auto const& entry : fs::directory_iterator(dir, ec))
+    {
+        string name = entry.path().filename().string();
+        auto inpos = name.rfind("-in.");
+        if (!entry.is_regular_file(ec) || inpos == string::npos || !wildcard_match(namepattern, name)) { continue; }
+
+        string outname = name.substr(0, inpos) + "-out." + name.substr(inpos + 4);
+        fs::path inpath = patternpath.has_parent_path() ? dir / name : fs::path(name);
+        fs::path outpath = patternpath.has_parent_path() ? dir / outname : fs::path(outname);
+        files.emplace_back(inpath.string(), outpath.string());
+    }
+    if (ec)
+    {
+        output << "Cannot read directory '" << dir.string() << "'!" << endl;
+        return {};
+    }
+    if (files.empty())
+    {
+        output << "No test input files (*-in.*) match '" << pattern << "'!" << endl;
+        return {};
+    }
+    sort(files.begin(), files.end());
+
+    struct FileResult
+    {
+        enum { NOT_RUN, STOPPED, NO_DIFFS, DIFFS_FOUND, NO_INPUT, NO_OUTPUT } status = NOT_RUN;
+        unsigned int lines = 0;     // Lines compared
+        unsigned int diff_line = 0; // First differing line
+        string actual;              // First differing lines
+        string expected;
+        double seconds = 0;
+    };
+    vector<FileResult> results(files.size());
+
+    auto run_file = [&](std::size_t i)
+    {
+        auto& result = results[i];
+        ifstream input(files[i].first);
+        if (!input) { result.status = FileResult::NO_INPUT; return; }
+        ifstream expected_output(files[i].second);
+        if (!expected_output) { result.status = FileResult::NO_OUTPUT; return; }
+
+        // Each file is run on its own program instance, and its output is
+        // compared with the expected output while it runs
+        auto start = std::chrono::steady_clock::now();
+        LineComparator comparator(expected_output);
+        std::ostream actual_output(&comparator);
+        auto program = std::make_unique<MainProgram>();
+        program->set_stop_parent(this);
+        program->command_parser(input, actual_output, PromptStyle::NO_NESTING);
+        program.reset();
+        if (check_stop()) { result.status = FileResult::STOPPED; return; }
+
+        bool same = comparator.finish();
+        result.status = same ? FileResult::NO_DIFFS : FileResult::DIFFS_FOUND;
+        result.lines = comparator.lines();
+        if (!same)
+        {
+            result.diff_line = comparator.lines();
+            result.actual = comparator.actual();
+            result.expected = comparator.expected();
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    unsigned int thread_count = max(1u, std::thread::hardware_concurrency());
+    thread_count = min(thread_count, static_cast<unsigned int>(files.size()));
+    std::atomic<std::size_t> next_file{0};
+    vector<std::thread> threads;
+    for (unsigned int t = 0; t < thread_count; ++t)
+    {
+        threads.emplace_back([&]()
+        {
+            for (auto i = next_file++; i < files.size() && !check_stop(); i = next_file++)
+            {
+                run_file(i);
+            }
+        });
+    }
+    for (auto& thread : threads) { thread.join(); }
+    double total_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    unsigned int passed = 0;
+    unsigned int failed = 0;
+    double slowest = 0;
+    for (std::size_t i = 0; i < files.size(); ++i)
+    {
+        auto const& result = results[i];
+        output << files[i].first << ": ";
+        switch (result.status)
+        {
+        case FileResult::NOT_RUN:
+            output << "not run" << endl;
+            continue;
+        case FileResult::STOPPED:
+            output << "stopped" << endl;
+            continue;
+        case FileResult::NO_INPUT:
+            output << "Cannot open file '" << files[i].first << "'!" << endl;
+            break;
+        case FileResult::NO_OUTPUT:
+            output << "Cannot open file '" << files[i].second << "'!" << endl;
+            break;
+        case FileResult::NO_DIFFS:
+            output << "no differences (" << result.lines << " lines, " << result.seconds << " sec)" << endl;
+            break;
+        case FileResult::DIFFS_FOUND:
+            output << "differences found on line " << result.diff_line << " (" << result.seconds << " sec)" << endl;
+            output << "  Actual:   " << result.actual << endl;
+            output << "  Expected: " << result.expected << endl;
+            break;
+        }
+        slowest = max(slowest, result.seconds);
+        if (result.status == FileResult::NO_DIFFS) { ++passed; } else { ++failed; }
+    }
+
+    if (passed + failed < files.size())
+    {
+        output << "Stopped!" << endl;
+    }
+    output << passed << " of " << files.size() << " tests passed using " << thread_count
+           << (thread_count == 1 ? " thread in " : " threads in ")
+           << total_seconds << " sec (slowest file " << slowest << " sec)" << endl;
+    if (failed > 0)
+    {
+        output << "**Differences found!**" << endl;
+        test_status_ = TestStatus::DIFFS_FOUND;
+    }
+    else if (passed > 0)
+    {
+        output << "**No differences in output.**" << endl;
+        if (test_status_ == TestStatus::NOT_RUN)
+        {
+            test_status_ = TestStatus::NO_DIFFS;
+        }
+    }
+
+    return {};
+}
+
 MainProgram::CmdResult MainProgram::cmd_place_count(std::ostream& output, MatchIter begin, MatchIter end)
 {
     assert( begin == end && "Impossible number of parameters!");
 
+    if (trace_) { trace_->write({TraceOp::PLACE_COUNT}); }
     output << "Number of places: " << ds_.place_count() << endl;
 
     return {};
@@ -795,6 +1221,7 @@ MainProgram::CmdResult MainProgram::cmd_all_places(std::ostream& output, MatchIt
 {
     assert( begin == end && "Impossible number of parameters!");
 
+    if (trace_) { trace_->write({TraceOp::ALL_PLACES}); }
     auto places = ds_.all_places();
     if (places.empty())
     {
@@ -809,6 +1236,7 @@ MainProgram::CmdResult MainProgram::cmd_all_areas(std::ostream& output, MainProg
 {
     assert( begin == end && "Impossible number of parameters!");
 
+    if (trace_) { trace_->write({TraceOp::ALL_AREAS}); }
     auto areas = ds_.all_areas();
     if (areas.empty())
     {
@@ -849,105 +1277,652 @@ MainProgram::CmdResult MainProgram::cmd_stopwatch(std::ostream& output, MatchIte
     return {};
 }
 
-MainProgram::CmdResult MainProgram::cmd_clear_all(std::ostream& output, MatchIter begin, MatchIter end)
+MainProgram::CmdResult MainProgram::cmd_perfcounters(std::ostream& output, MatchIter begin, MatchIter end)
 {
+    string on = *begin++;
+    string off = *begin++;
     assert(begin == end && "Invalid number of parameters");
 
-    ds_.clear_all();
-    init_primes();
-
-    output << "Cleared everything." << endl;
-
-    view_dirty = true;
-
-    return {};
-}
-
-std::string MainProgram::print_place(PlaceID id, ostream& output, bool nl)
-{
-    if (id != NO_PLACE)
+    if (!on.empty())
     {
-        auto [name,type] = ds_.get_place_name_type(id);
-        auto xy = ds_.get_place_coord(id);
-        if (!name.empty())
+        PerfCounters counters;
+        if (!counters.available())
         {
-            output << name << " (" << convert_placetype_to_string(type) << ")";
+            output << "Performance counters not available (" << counters.error() << ")" << endl;
+            return {};
         }
-        else
+        perfcounters_ = true;
+        output << "Performance counters: on";
+        if (!counters.error().empty())
         {
-            output << "*";
+            output << " (some not available: " << counters.error() << ")";
         }
-
-         output << ": pos=";
-         print_coord(xy, output, false);
-         output << ", id=" << id;
-         if (nl) { output << endl; }
-
-        ostringstream retstream;
-        retstream << id;
-        return retstream.str();
+        output << endl;
+    }
+    else if (!off.empty())
+    {
+        perfcounters_ = false;
+        output << "Performance counters: off" << endl;
     }
     else
     {
-        output << "--NO_PLACE--";
-        if (nl) { output << endl; }
-        return "";
+        assert(!"Impossible perfcounters mode!");
     }
+
+    return {};
 }
 
-std::string MainProgram::print_place_name(PlaceID id, std::ostream &output, bool nl)
+MainProgram::CmdResult MainProgram::cmd_stats(std::ostream& output, MatchIter /*begin*/, MatchIter /*end*/)
 {
-    if (id != NO_PLACE)
+    if (!Datastructures::stats_enabled())
     {
-        auto [name,type] = ds_.get_place_name_type(id);
-        if (!name.empty())
-        {
-            output << name;
-        }
-        else
-        {
-            output << "*";
-        }
+        output << "Statistics not collected (compile with DATASTRUCTURES_STATS defined, e.g. qmake CONFIG+=stats)" << endl;
+        return {};
+    }
 
-        ostringstream retstream;
-        retstream << name;
-        if (nl) { output << endl; }
-        return retstream.str();
+    auto stats = ds_.stats();
+    ds_.reset_stats();
+
+    // Operations in the order of decreasing total time
+    using Operation = Datastructures::Operation;
+    vector<Operation> operations;
+    unsigned long long int total_ns = 0;
+    for (unsigned int i = 0; i < stats.operations.size(); ++i)
+    {
+        if (stats.operations[i].calls == 0) { continue; }
+        operations.push_back(static_cast<Operation>(i));
+        total_ns += stats.operations[i].total_ns;
     }
-    else
+    auto opstats = [&stats](Operation op) -> Datastructures::OperationStats const& { return stats.operations[static_cast<unsigned int>(op)]; };
+    sort(operations.begin(), operations.end(), [&opstats](Operation op1, Operation op2){ return opstats(op1).total_ns > opstats(op2).total_ns; });
+
+    output << setw(24) << std::left << "operation" << std::right << " , " << setw(10) << "calls" << " , " << setw(12) << "total (sec)"
+           << " , " << setw(11) << "mean (usec)" << " , " << setw(7) << "time %" << endl;
+    for (auto op : operations)
     {
-        output << "--NO_PLACE--";
-        if (nl) { output << endl; }
-        return "";
+        auto& opstat = opstats(op);
+        output << setw(24) << std::left << Datastructures::operation_name(op) << std::right << " , " << setw(10) << opstat.calls
+               << " , " << setw(12) << opstat.total_ns*1e-9 << " , " << setw(11) << opstat.total_ns*1e-3/opstat.calls
+               << " , " << setw(7) << ((total_ns > 0) ? 100.0*opstat.total_ns/total_ns : 0.0) << endl;
     }
+
+    auto cache_line = [&output](string const& name, unsigned long long int hits, unsigned long long int rebuilds)
+    {
+        auto uses = hits + rebuilds;
+        output << name << " cache: " << hits << " hits, " << rebuilds << " rebuilds";
+        if (uses > 0) { output << " (" << 100.0*hits/uses << " % reused)"; }
+        output << endl;
+    };
+    cache_line("Alphabetical order", stats.name_cache_hits, stats.name_cache_rebuilds);
+    cache_line("Coordinate order", stats.coord_cache_hits, stats.coord_cache_rebuilds);
+    output << "Statistics reset." << endl;
+
+    return {};
 }
 
-std::string MainProgram::print_area(AreaID id, std::ostream& output, bool nl)
+MainProgram::CmdResult MainProgram::cmd_record(std::ostream& output, MatchIter begin, MatchIter end)
 {
-    if (id != NO_AREA)
+    string filename = *begin++;
+    string off = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    if (trace_)
     {
-        auto name = ds_.get_area_name(id);
-        if (!name.empty())
+        trace_->close();
+        output << "Recording stopped, " << trace_->count() << " operations recorded." << endl;
+        trace_.reset();
+    }
+
+    if (off.empty())
+    {
+        auto trace = std::make_unique<TraceWriter>(filename, trace_header());
+        if (!trace->good())
         {
-            output << name << ": id=" << id;
+            output << "Cannot open file '" << filename << "'!" << endl;
+            return {};
         }
-        else
-        {
-            output << "*" << ": id=" << id;
+        trace_ = std::move(trace);
+        output << "Recording commands to '" << filename << "'" << endl;
+    }
+
+    return {};
+}
+
+TraceHeader MainProgram::trace_header()
+{
+    std::ostringstream state;
+    state << rand_engine_;
+
+    TraceHeader header;
+    header.rand_state = std::stoull(state.str());
+    header.prime1 = prime1_;
+    header.prime2 = prime2_;
+    header.random_places_added = random_places_added_;
+    header.random_areas_added = random_areas_added_;
+    header.place_count = static_cast<std::uint64_t>(ds_.place_count());
+    return header;
+}
+
+MainProgram::CmdResult MainProgram::cmd_replay(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string filename = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    ifstream input(filename, std::ios::binary);
+    if (!input)
+    {
+        output << "Cannot open file '" << filename << "'!" << endl;
+        return {};
+    }
+    auto [header, records] = read_trace(input);
+
+    if (static_cast<std::uint64_t>(ds_.place_count()) != header.place_count)
+    {
+        output << "Warning: trace was recorded with " << header.place_count << " places, now there are "
+               << ds_.place_count() << endl;
+    }
+
+    // Restore the random state, so that random_add adds the same places as when recording
+    std::istringstream state(std::to_string(header.rand_state));
+    state >> rand_engine_;
+    prime1_ = header.prime1;
+    prime2_ = header.prime2;
+    random_places_added_ = header.random_places_added;
+    random_areas_added_ = header.random_areas_added;
+
+    Stopwatch stopwatch;
+    stopwatch.start();
+    for (auto& record : records)
+    {
+        replay_record(record);
+    }
+    stopwatch.stop();
+
+    auto sec = stopwatch.elapsed();
+    output << "Replayed " << records.size() << " operations from '" << filename << "' in " << sec << " sec";
+    if (sec > 0) { output << " (" << records.size() / sec << " operations/sec)"; }
+    output << endl;
+
+    view_dirty = true;
+    return {};
+}
+
+void MainProgram::record_mutation(TraceRecord const& record)
+{
+    if (trace_) { trace_->write(record); }
+    if (wal_) { wal_->append(record); }
+}
+
+std::vector<TraceRecord> MainProgram::snapshot_records()
+{
+    std::vector<TraceRecord> records;
+    for (auto id : ds_.all_places_view())
+    {
+        auto [name, type] = ds_.get_place_name_type(id);
+        records.push_back({TraceOp::ADD_PLACE, id, 0, name, type, ds_.get_place_coord(id)});
+    }
+    auto areas = ds_.all_areas_view();
+    for (auto id : areas)
+    {
+        records.push_back({TraceOp::ADD_AREA, id, 0, ds_.get_area_name(id), PlaceType::NO_TYPE, NO_COORD, NO_COORD, ds_.get_area_coords(id)});
+    }
+    for (auto id : areas)
+    {
+        auto parents = ds_.subarea_in_areas(id);
+        if (!parents.empty()) { records.push_back({TraceOp::ADD_SUBAREA_TO_AREA, id, parents.front()}); }
+    }
+    return records;
+}
+
+MainProgram::CmdResult MainProgram::cmd_wal(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string basename = *begin++;
+    string off = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    if (wal_)
+    {
+        bool ok = wal_->commit();
+        auto count = wal_->count();
+        auto commits = wal_->commits();
+        wal_.reset();
+        output << "Write-ahead log closed, " << count << " changes logged in " << commits << " commits." << endl;
+        if (!ok) { output << "Writing to the log failed, the latest changes are not in it!" << endl; }
+    }
+    if (!off.empty()) { return {}; }
+
+    // Recover the data from the snapshot and the log, if they exist. The
+    // recovered data replaces the current data.
+    string snapshotname = basename + ".snapshot";
+    string logname = basename + ".wal";
+    bool has_snapshot = std::filesystem::exists(snapshotname);
+    bool has_log = std::filesystem::exists(logname);
+    if (has_snapshot || has_log)
+    {
+        std::uint64_t valid_size = 0;
+        auto snapshot = has_snapshot ? read_log(snapshotname, valid_size) : vector<TraceRecord>{};
+        auto log = has_log ? read_log(logname, valid_size) : vector<TraceRecord>{};
+        if (has_log && valid_size < std::filesystem::file_size(logname))
+        {
+            output << "Ignoring incomplete end of '" << logname << "'" << endl;
+            truncate_file(logname, valid_size);
+        }
+
+        Stopwatch stopwatch;
+        stopwatch.start();
+        ds_.clear_all();
+        for (auto& record : snapshot) { replay_record(record); }
+        for (auto& record : log) { replay_record(record); }
+        stopwatch.stop();
+        output << "Recovered " << snapshot.size() << " records from '" << snapshotname << "' and " << log.size()
+               << " changes from '" << logname << "' in " << stopwatch.elapsed() << " sec" << endl;
+        view_dirty = true;
+    }
+    else if (!write_snapshot(snapshotname, snapshot_records()))
+    {
+        output << "Cannot write file '" << snapshotname << "'!" << endl;
+        return {};
+    }
+
+    auto wal = std::make_unique<WriteAheadLog>(logname);
+    if (!wal->good())
+    {
+        output << "Cannot open file '" << logname << "'!" << endl;
+        return {};
+    }
+    wal_ = std::move(wal);
+    wal_snapshot_ = snapshotname;
+    output << "Logging changes to '" << logname << "'" << endl;
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_checkpoint(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    assert(begin == end && "Invalid number of parameters");
+
+    if (!wal_)
+    {
+        output << "Write-ahead log is not on (use wal \"filename\")!" << endl;
+        return {};
+    }
+
+    // Writing the snapshot before emptying the log keeps the data recoverable
+    // if the program crashes between the two
+    if (!wal_->commit())
+    {
+        output << "Writing to '" << wal_->filename() << "' failed, the latest changes are not in it!" << endl;
+    }
+    auto records = snapshot_records();
+    if (!write_snapshot(wal_snapshot_, records))
+    {
+        output << "Cannot write file '" << wal_snapshot_ << "'!" << endl;
+        return {};
+    }
+    if (!wal_->truncate())
+    {
+        output << "Cannot empty file '" << wal_->filename() << "'!" << endl;
+        return {};
+    }
+    output << "Wrote snapshot of " << records.size() << " records to '" << wal_snapshot_ << "', log emptied." << endl;
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_apply_batch(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string filename = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    ifstream input(filename);
+    if (!input)
+    {
+        output << "Cannot open file '" << filename << "'!" << endl;
+        return {};
+    }
+
+    // Each line of the file is an add_place, change_place_name, change_place_coord or
+    // remove_place command, with the same syntax as when given as a command
+    vector<Mutation> mutations;
+    vector<unsigned int> linenos;
+    string line;
+    for (unsigned int lineno = 1; getline(input, line); ++lineno)
+    {
+        if (line.empty() || line[0] == '#') { continue; }
+
+        smatch match;
+        smatch params;
+        bool valid = regex_match(line, match, cmds_regex_);
+        if (valid)
+        {
+            string cmd = match[1];
+            string paramstr = match[2];
+            auto pos = find_if(cmds_.begin(), cmds_.end(), [&cmd](CmdInfo const& ci) { return ci.cmd == cmd; });
+            valid = regex_match(paramstr, params, pos->param_regex);
+            if (valid && cmd == "add_place")
+            {
+                PlaceType type = convert_string_to_placetype(params[3]);
+                valid = (type != PlaceType::NO_TYPE);
+                mutations.push_back({Mutation::Type::ADD_PLACE, convert_string_to<PlaceID>(params[1]), params[2], type,
+                                     {convert_string_to<int>(params[4]), convert_string_to<int>(params[5])}});
+            }
+            else if (valid && cmd == "change_place_name")
+            {
+                mutations.push_back({Mutation::Type::CHANGE_PLACE_NAME, convert_string_to<PlaceID>(params[1]), params[2]});
+            }
+            else if (valid && cmd == "change_place_coord")
+            {
+                mutations.push_back({Mutation::Type::CHANGE_PLACE_COORD, convert_string_to<PlaceID>(params[1]), NO_NAME,
+                                     PlaceType::NO_TYPE, {convert_string_to<int>(params[2]), convert_string_to<int>(params[3])}});
+            }
+            else if (valid && cmd == "remove_place")
+            {
+                mutations.push_back({Mutation::Type::REMOVE_PLACE, convert_string_to<PlaceID>(params[1])});
+            }
+            else
+            {
+                valid = false;
+            }
+        }
+        if (!valid)
+        {
+            output << "Invalid change on line " << lineno << " of '" << filename << "': " << line << endl;
+            output << "Nothing changed!" << endl;
+            return {};
         }
+        linenos.push_back(lineno);
+    }
+
+    auto invalid = ds_.apply_batch(mutations);
+    if (invalid < mutations.size())
+    {
+        auto id = mutations[invalid].id;
+        output << "Change on line " << linenos[invalid] << " of '" << filename << "' fails (place " << id
+               << ((mutations[invalid].type == Mutation::Type::ADD_PLACE) ? " already exists" : " not found") << ")!" << endl;
+        output << "Nothing changed!" << endl;
+        return {};
+    }
+
+    for (auto const& mutation : mutations)
+    {
+        switch (mutation.type)
+        {
+        case Mutation::Type::ADD_PLACE:
+            record_mutation({TraceOp::ADD_PLACE, mutation.id, 0, mutation.name, mutation.placetype, mutation.xy});
+            break;
+        case Mutation::Type::CHANGE_PLACE_NAME:
+            record_mutation({TraceOp::CHANGE_PLACE_NAME, mutation.id, 0, mutation.name});
+            break;
+        case Mutation::Type::CHANGE_PLACE_COORD:
+            record_mutation({TraceOp::CHANGE_PLACE_COORD, mutation.id, 0, {}, PlaceType::NO_TYPE, mutation.xy});
+            break;
+        case Mutation::Type::REMOVE_PLACE:
+            record_mutation({TraceOp::REMOVE_PLACE, mutation.id});
+            break;
+        }
+    }
+
+    output << "Applied " << mutations.size() << " changes from '" << filename << "'." << endl;
+    view_dirty = true;
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_changes(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    assert(begin == end && "Invalid number of parameters");
+
+    vector<ChangeEvent> events;
+    if (!ds_.change_feed().read(changes_cursor_, events))
+    {
+        output << "Some changes were lost (too many since the last 'changes')!" << endl;
+        return {};
+    }
+
+    for (auto const& event : events)
+    {
+        switch (event.type)
+        {
+        case ChangeEvent::Type::PLACE_ADDED:
+            output << "Place " << event.id << " added at ";
+            print_coord(event.xy, output);
+            break;
+        case ChangeEvent::Type::PLACE_RENAMED:
+            output << "Place " << event.id << " renamed" << endl;
+            break;
+        case ChangeEvent::Type::PLACE_MOVED:
+            output << "Place " << event.id << " moved to ";
+            print_coord(event.xy, output);
+            break;
+        case ChangeEvent::Type::PLACE_REMOVED:
+            output << "Place " << event.id << " removed" << endl;
+            break;
+        case ChangeEvent::Type::AREA_ADDED:
+            output << "Area " << event.id << " added" << endl;
+            break;
+        case ChangeEvent::Type::SUBAREA_LINKED:
+            output << "Area " << event.id << " made a subarea of " << event.id2 << endl;
+            break;
+        case ChangeEvent::Type::CLEARED:
+            output << "All places and areas cleared" << endl;
+            break;
+        }
+    }
+    output << events.size() << " changes." << endl;
+    return {};
+}
+
+void MainProgram::replay_record(TraceRecord const& record)
+{
+    if (wal_) { wal_->append(record); } // Ignores queries, random_add logs the places it adds
+
+    switch (record.op)
+    {
+    case TraceOp::PLACE_COUNT:
+        ds_.place_count();
+        break;
+    case TraceOp::CLEAR_ALL:
+        ds_.clear_all();
+        init_primes();
+        break;
+    case TraceOp::ALL_PLACES:
+        ds_.all_places();
+        break;
+    case TraceOp::ADD_PLACE:
+        ds_.add_place(record.id1, record.name, record.type, record.xy);
+        break;
+    case TraceOp::GET_PLACE_NAME_TYPE:
+        ds_.get_place_name_type(record.id1);
+        break;
+    case TraceOp::GET_PLACE_COORD:
+        ds_.get_place_coord(record.id1);
+        break;
+    case TraceOp::PLACES_ALPHABETICALLY:
+        ds_.places_alphabetically();
+        break;
+    case TraceOp::PLACES_COORD_ORDER:
+        ds_.places_coord_order();
+        break;
+    case TraceOp::PLACES_ALPHABETICALLY_PAGE:
+        ds_.places_alphabetically(static_cast<std::size_t>(record.id1), static_cast<std::size_t>(record.id2));
+        break;
+    case TraceOp::PLACES_COORD_ORDER_PAGE:
+        ds_.places_coord_order(static_cast<std::size_t>(record.id1), static_cast<std::size_t>(record.id2));
+        break;
+    case TraceOp::FIND_PLACES_NAME:
+        ds_.find_places_name(record.name);
+        break;
+    case TraceOp::FIND_PLACES_TYPE:
+        ds_.find_places_type(record.type);
+        break;
+    case TraceOp::CHANGE_PLACE_NAME:
+        ds_.change_place_name(record.id1, record.name);
+        break;
+    case TraceOp::CHANGE_PLACE_COORD:
+        ds_.change_place_coord(record.id1, record.xy);
+        break;
+    case TraceOp::ADD_AREA:
+        ds_.add_area(record.id1, record.name, record.coords);
+        break;
+    case TraceOp::GET_AREA_NAME:
+        ds_.get_area_name(record.id1);
+        break;
+    case TraceOp::GET_AREA_COORDS:
+        ds_.get_area_coords(record.id1);
+        break;
+    case TraceOp::ALL_AREAS:
+        ds_.all_areas();
+        break;
+    case TraceOp::ADD_SUBAREA_TO_AREA:
+        ds_.add_subarea_to_area(record.id1, record.id2);
+        break;
+    case TraceOp::SUBAREA_IN_AREAS:
+        ds_.subarea_in_areas(record.id1);
+        break;
+    case TraceOp::CREATION_FINISHED:
+        ds_.creation_finished();
+        break;
+    case TraceOp::ALL_SUBAREAS_IN_AREA:
+        ds_.all_subareas_in_area(record.id1);
+        break;
+    case TraceOp::PLACES_CLOSEST_TO:
+        ds_.places_closest_to(record.xy, record.type);
+        break;
+    case TraceOp::REMOVE_PLACE:
+        ds_.remove_place(record.id1);
+        break;
+    case TraceOp::COMMON_AREA_OF_SUBAREAS:
+        ds_.common_area_of_subareas(record.id1, record.id2);
+        break;
+    case TraceOp::AREAS_CONTAINING:
+        ds_.areas_containing(record.xy);
+        break;
+    case TraceOp::INFER_SUBAREAS:
+        ds_.infer_subareas();
+        break;
+    case TraceOp::PLACES_IN_AREA:
+        ds_.places_in_area(record.id1, record.id2 != 0);
+        break;
+    case TraceOp::AREAS_OF_PLACE:
+        ds_.areas_of_place(record.id1);
+        break;
+    case TraceOp::AREA_STATS:
+        ds_.area_stats(record.id1);
+        break;
+    case TraceOp::RANDOM_SEED:
+        rand_engine_.seed(static_cast<unsigned long int>(record.id1));
+        init_primes();
+        break;
+    case TraceOp::RANDOM_ADD:
+        add_random_places_areas(static_cast<unsigned int>(record.id1), record.xy, record.xy2);
+        break;
+    default:
+        assert(!"Unknown trace operation!");
+    }
+}
+
+MainProgram::CmdResult MainProgram::cmd_clear_all(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    assert(begin == end && "Invalid number of parameters");
+
+    record_mutation({TraceOp::CLEAR_ALL});
+    ds_.clear_all();
+    init_primes();
+
+    output << "Cleared everything." << endl;
+
+    view_dirty = true;
+
+    return {};
+}
+
+std::string MainProgram::print_place(PlaceID id, ostream& output, bool nl)
+{
+    OutputBuffer buffer(output);
+    print_place(id, buffer, nl);
+    return (id != NO_PLACE) ? std::to_string(id) : "";
+}
+
+void MainProgram::print_place(PlaceID id, OutputBuffer& output, bool nl)
+{
+    if (id != NO_PLACE)
+    {
+        auto [name,type] = ds_.get_place_name_type(id);
+        auto xy = ds_.get_place_coord(id);
+        if (!name.empty())
+        {
+            output << name << " (" << convert_placetype_to_string(type) << ")";
+        }
+        else
+        {
+            output << "*";
+        }
+
+         output << ": pos=";
+         print_coord(xy, output, false);
+         output << ", id=" << id;
+         if (nl) { output << '\n'; }
+    }
+    else
+    {
+        output << "--NO_PLACE--";
+        if (nl) { output << '\n'; }
+    }
+}
+
+std::string MainProgram::print_place_name(PlaceID id, std::ostream &output, bool nl)
+{
+    if (id != NO_PLACE)
+    {
+        auto [name,type] = ds_.get_place_name_type(id);
+        if (!name.empty())
+        {
+            output << name;
+        }
+        else
+        {
+            output << "*";
+        }
+
         ostringstream retstream;
-        retstream << id;
+        retstream << name;
         if (nl) { output << endl; }
         return retstream.str();
     }
     else
     {
-        output << "--NO_AREA--";
+        output << "--NO_PLACE--";
         if (nl) { output << endl; }
         return "";
     }
 }
 
+std::string MainProgram::print_area(AreaID id, std::ostream& output, bool nl)
+{
+    OutputBuffer buffer(output);
+    print_area(id, buffer, nl);
+    return (id != NO_AREA) ? std::to_string(id) : "";
+}
+
+void MainProgram::print_area(AreaID id, OutputBuffer& output, bool nl)
+{
+    if (id != NO_AREA)
+    {
+        auto name = ds_.get_area_name(id);
+        if (!name.empty())
+        {
+            output << name << ": id=" << id;
+        }
+        else
+        {
+            output << "*" << ": id=" << id;
+        }
+        if (nl) { output << '\n'; }
+    }
+    else
+    {
+        output << "--NO_AREA--";
+        if (nl) { output << '\n'; }
+    }
+}
+
 std::string MainProgram::print_way(WayID id, std::ostream &output, bool nl)
 {
     if (id != NO_WAY)
@@ -967,20 +1942,24 @@ std::string MainProgram::print_way(WayID id, std::ostream &output, bool nl)
 }
 
 std::string MainProgram::print_coord(Coord coord, std::ostream& output, bool nl)
+{
+    OutputBuffer buffer(output);
+    print_coord(coord, buffer, nl);
+    if (coord == NO_COORD) { return ""; }
+    return "(" + std::to_string(coord.x) + "," + std::to_string(coord.y) + ")";
+}
+
+void MainProgram::print_coord(Coord coord, OutputBuffer& output, bool nl)
 {
     if (coord != NO_COORD)
     {
         output << "(" << coord.x << "," << coord.y << ")";
-        ostringstream retstream;
-        retstream << "(" << coord.x << "," << coord.y << ")";
-        if (nl) { output << endl; }
-        return retstream.str();
+        if (nl) { output << '\n'; }
     }
     else
     {
         output << "(--NO_COORD--)";
-        if (nl) { output << endl; }
-        return "";
+        if (nl) { output << '\n'; }
     }
 }
 
@@ -989,6 +1968,7 @@ MainProgram::CmdResult MainProgram::cmd_find_places_name(std::ostream& output, M
     string name = *begin++;
     assert( begin == end && "Impossible number of parameters!");
 
+    if (trace_) { trace_->write({TraceOp::FIND_PLACES_NAME, 0, 0, name}); }
     auto result = ds_.find_places_name(name);
     if (result.empty())
     {
@@ -1021,6 +2001,7 @@ MainProgram::CmdResult MainProgram::cmd_find_places_type(std::ostream &output, M
         return {ResultType::PLACEIDLIST, CmdResultPlaceIDs{NO_AREA, {NO_PLACE}}};
     }
 
+    if (trace_) { trace_->write({TraceOp::FIND_PLACES_TYPE, 0, 0, {}, type}); }
     auto result = ds_.find_places_type(type);
     if (result.empty())
     {
@@ -1051,40 +2032,72 @@ string const optcoordx = "\\([[:space:]]*[0-9]+[[:space:]]*,[[:space:]]*[0-9]+[[
 string const coordx = "\\([[:space:]]*([0-9]+)[[:space:]]*,[[:space:]]*([0-9]+)[[:space:]]*\\)";
 string const wsx = "[[:space:]]+";
 
+using Op = Datastructures::Operation;
+
 vector<MainProgram::CmdInfo> MainProgram::cmds_ =
 {
     {"add_place", "ID 'Name' Type (x,y)", plcidx+wsx+namex+wsx+typex+wsx+coordx, &MainProgram::cmd_add_place, nullptr },
     {"random_add", "number_of_places_to_add  [(minx,miny) (maxx,maxy)] (coordinates optional)", numx+"(?:"+wsx+coordx+wsx+coordx+")?",
-     &MainProgram::cmd_random_add, &MainProgram::test_random_add },
+     &MainProgram::cmd_random_add, &MainProgram::test_random_add, Op::ADD_PLACE },
     {"all_places", "", "", &MainProgram::cmd_all_places, nullptr },
-    {"place_name_type", "ID", plcidx, &MainProgram::cmd_place_name_type, &MainProgram::test_place_name_type },
-    {"place_coord", "ID", plcidx, &MainProgram::cmd_place_coord, &MainProgram::test_place_coord },
+    {"place_name_type", "ID", plcidx, &MainProgram::cmd_place_name_type, &MainProgram::test_place_name_type, Op::GET_PLACE_NAME_TYPE },
+    {"place_coord", "ID", plcidx, &MainProgram::cmd_place_coord, &MainProgram::test_place_coord, Op::GET_PLACE_COORD },
     {"add_area", "ID Name (x,y) (x,y)...", areaidx+wsx+namex+"((?:"+wsx+optcoordx+")+)", &MainProgram::cmd_add_area, nullptr },
     {"all_areas", "", "", &MainProgram::cmd_all_areas, nullptr },
-    {"area_name", "AreaID", areaidx, &MainProgram::cmd_area_name, &MainProgram::test_area_name },
+    {"area_name", "AreaID", areaidx, &MainProgram::cmd_area_name, &MainProgram::test_area_name, Op::GET_AREA_NAME },
     {"area_coords", "AreaID", areaidx, &MainProgram::cmd_area_coords, nullptr },
     {"creation_finished", "", "", &MainProgram::cmd_creation_finished, nullptr },
     {"place_count", "", "", &MainProgram::cmd_place_count, nullptr },
     {"clear_all", "", "", &MainProgram::cmd_clear_all, nullptr },
-    {"places_alphabetically", "", "", &MainProgram::NoParPlaceListCmd<&Datastructures::places_alphabetically>, &MainProgram::NoParPlaceListTestCmd<&Datastructures::places_alphabetically> },
-    {"places_coord_order", "", "", &MainProgram::NoParPlaceListCmd<&Datastructures::places_coord_order>, &MainProgram::NoParPlaceListTestCmd<&Datastructures::places_coord_order> },
-    {"places_closest_to", "Coord [type] (type optional)", coordx+"(?:"+wsx+typex+")?", &MainProgram::cmd_places_closest_to, &MainProgram::test_places_closest_to },
-    {"common_area_of_subareas", "ID1 ID2", plcidx+wsx+plcidx, &MainProgram::cmd_common_area_of_subareas, &MainProgram::test_common_area_of_subareas },
-    {"remove_place", "ID", plcidx, &MainProgram::cmd_remove_place, &MainProgram::test_remove_place },
-    {"find_places_name", "'Name'", namex, &MainProgram::cmd_find_places_name, &MainProgram::test_find_places_name },
-    {"find_places_type", "type", typex, &MainProgram::cmd_find_places_type, &MainProgram::test_find_places_type },
-    {"change_place_name", "ID 'Newname'", plcidx+wsx+namex, &MainProgram::cmd_change_place_name, &MainProgram::test_change_place_name },
-    {"change_place_coord", "ID (x,y)", plcidx+wsx+coordx, &MainProgram::cmd_change_place_coord, &MainProgram::test_change_place_coord },
+    {"places_alphabetically", "", "", &MainProgram::NoParPlaceListCmd<&Datastructures::places_alphabetically, TraceOp::PLACES_ALPHABETICALLY>, &MainProgram::NoParPlaceListTestCmd<&Datastructures::places_alphabetically>, Op::PLACES_ALPHABETICALLY },
+    {"places_coord_order", "", "", &MainProgram::NoParPlaceListCmd<&Datastructures::places_coord_order, TraceOp::PLACES_COORD_ORDER>, &MainProgram::NoParPlaceListTestCmd<&Datastructures::places_coord_order>, Op::PLACES_COORD_ORDER },
+    {"places_alphabetically_page", "offset limit", numx+wsx+numx,
+     &MainProgram::PagedPlaceListCmd<&Datastructures::places_alphabetically, TraceOp::PLACES_ALPHABETICALLY_PAGE>,
+     &MainProgram::PagedPlaceListTestCmd<&Datastructures::places_alphabetically>, Op::PLACES_ALPHABETICALLY_PAGE },
+    {"places_coord_order_page", "offset limit", numx+wsx+numx,
+     &MainProgram::PagedPlaceListCmd<&Datastructures::places_coord_order, TraceOp::PLACES_COORD_ORDER_PAGE>,
+     &MainProgram::PagedPlaceListTestCmd<&Datastructures::places_coord_order>, Op::PLACES_COORD_ORDER_PAGE },
+    {"places_closest_to", "Coord [type] (type optional)", coordx+"(?:"+wsx+typex+")?", &MainProgram::cmd_places_closest_to, &MainProgram::test_places_closest_to, Op::PLACES_CLOSEST_TO },
+    {"common_area_of_subareas", "ID1 ID2", plcidx+wsx+plcidx, &MainProgram::cmd_common_area_of_subareas, &MainProgram::test_common_area_of_subareas, Op::COMMON_AREA_OF_SUBAREAS },
+    {"remove_place", "ID", plcidx, &MainProgram::cmd_remove_place, &MainProgram::test_remove_place, Op::REMOVE_PLACE },
+    {"find_places_name", "'Name'", namex, &MainProgram::cmd_find_places_name, &MainProgram::test_find_places_name, Op::FIND_PLACES_NAME },
+    {"find_places_type", "type", typex, &MainProgram::cmd_find_places_type, &MainProgram::test_find_places_type, Op::FIND_PLACES_TYPE },
+    {"change_place_name", "ID 'Newname'", plcidx+wsx+namex, &MainProgram::cmd_change_place_name, &MainProgram::test_change_place_name, Op::CHANGE_PLACE_NAME },
+    {"change_place_coord", "ID (x,y)", plcidx+wsx+coordx, &MainProgram::cmd_change_place_coord, &MainProgram::test_change_place_coord, Op::CHANGE_PLACE_COORD },
     {"add_subarea_to_area", "SubareaID AreaID", areaidx+wsx+areaidx, &MainProgram::cmd_add_subarea_to_area, nullptr },
-    {"subarea_in_areas", "AreaID", areaidx, &MainProgram::cmd_subarea_in_areas, &MainProgram::test_subarea_in_areas },
-    {"all_subareas_in_area", "AreaID", areaidx, &MainProgram::cmd_all_subareas_in_area, &MainProgram::test_all_subareas_in_area },
+    {"subarea_in_areas", "AreaID", areaidx, &MainProgram::cmd_subarea_in_areas, &MainProgram::test_subarea_in_areas, Op::SUBAREA_IN_AREAS },
+    {"all_subareas_in_area", "AreaID", areaidx, &MainProgram::cmd_all_subareas_in_area, &MainProgram::test_all_subareas_in_area, Op::ALL_SUBAREAS_IN_AREA },
+    {"areas_containing", "(x,y)", coordx, &MainProgram::cmd_areas_containing, &MainProgram::test_areas_containing, Op::AREAS_CONTAINING },
+    {"places_in_area", "AreaID [recursive]", areaidx+"(?:"+wsx+"(recursive))?", &MainProgram::cmd_places_in_area, &MainProgram::test_places_in_area, Op::PLACES_IN_AREA },
+    {"areas_of_place", "PlaceID", plcidx, &MainProgram::cmd_areas_of_place, &MainProgram::test_areas_of_place, Op::AREAS_OF_PLACE },
+    {"area_stats", "AreaID", areaidx, &MainProgram::cmd_area_stats, &MainProgram::test_area_stats, Op::AREA_STATS },
+    {"infer_subareas", "(makes areas subareas of the areas containing them)", "", &MainProgram::cmd_infer_subareas, nullptr },
     {"quit", "", "", nullptr, nullptr },
     {"help", "", "", &MainProgram::help_command, nullptr },
     {"read", "\"in-filename\" [silent]", "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+"(silent))?", &MainProgram::cmd_read, nullptr },
     {"testread", "\"in-filename\" \"out-filename\"", "\"([-a-zA-Z0-9 ./:_]+)\""+wsx+"\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_testread, nullptr },
-    {"perftest", "cmd1|all|compulsory[;cmd2...] timeout repeat_count n1[;n2...] (parts in [] are optional, alternatives separated by |)",
-     "([0-9a-zA-Z_]+(?:;[0-9a-zA-Z_]+)*)"+wsx+numx+wsx+numx+wsx+"([0-9]+(?:;[0-9]+)*)", &MainProgram::cmd_perftest, nullptr },
+    {"testread_all", "\"in-filename-pattern\" (e.g. \"*-in.txt\", output read from the matching -out file)",
+     "\"([-a-zA-Z0-9 ./:_*?]+)\"", &MainProgram::cmd_testread_all, nullptr },
+    {"perftest", "cmd1|all|compulsory[;cmd2...] timeout repeat_count n1[;n2...] [format=json|csv [\"out-filename\"]] (parts in [] are optional, alternatives separated by |)",
+     "([0-9a-zA-Z_]+(?:;[0-9a-zA-Z_]+)*)"+wsx+numx+wsx+numx+wsx+"([0-9]+(?:;[0-9]+)*)"+
+     "(?:"+wsx+"format=(json|csv)(?:"+wsx+"\"([-a-zA-Z0-9 ./:_]+)\")?)?", &MainProgram::cmd_perftest, nullptr },
+    {"perftest_mt", "threads=n1[;n2...] read_ratio=ratio seconds n (0 <= ratio <= 1, n is number of places)",
+     "threads=([0-9]+(?:;[0-9]+)*)"+wsx+"read_ratio=([0-9]+(?:\\.[0-9]+)?)"+wsx+numx+wsx+numx, &MainProgram::cmd_perftest_mt, nullptr },
+    {"perfcompare", "\"baseline-filename\" [max_time_ratio] (default ratio 1.5)", "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+"([0-9]+(?:\\.[0-9]+)?))?",
+     &MainProgram::cmd_perfcompare, nullptr },
     {"stopwatch", "on|off|next (alternatives separated by |)", "(?:(on)|(off)|(next))", &MainProgram::cmd_stopwatch, nullptr },
+    {"perfcounters", "on|off (hardware performance counters in perftest, alternatives separated by |)", "(?:(on)|(off))",
+     &MainProgram::cmd_perfcounters, nullptr },
+    {"stats", "", "", &MainProgram::cmd_stats, nullptr },
+    {"record", "\"out-filename\"|off (records the operations of following commands)",
+     "(?:\"([-a-zA-Z0-9 ./:_]+)\"|(off))", &MainProgram::cmd_record, nullptr },
+    {"replay", "\"in-filename\" (replays operations recorded with record)", "\"([-a-zA-Z0-9 ./:_]+)\"", &MainProgram::cmd_replay, nullptr },
+    {"wal", "\"basename\"|off (logs changes to basename.wal, recovers the data if the files exist)",
+     "(?:\"([-a-zA-Z0-9 ./:_]+)\"|(off))", &MainProgram::cmd_wal, nullptr },
+    {"checkpoint", "(writes a snapshot of the data and empties the write-ahead log)", "", &MainProgram::cmd_checkpoint, nullptr },
+    {"apply_batch", "\"filename\" (applies the place changes in the file if they are all valid)", "\"([-a-zA-Z0-9 ./:_]+)\"",
+     &MainProgram::cmd_apply_batch, nullptr },
+    {"changes", "(lists the changes to the data since the previous 'changes')", "", &MainProgram::cmd_changes, nullptr },
     {"random_seed", "new-random-seed-integer", numx, &MainProgram::cmd_randseed, nullptr },
     {"#", "comment text", ".*", &MainProgram::cmd_comment, nullptr },
 };
@@ -1101,20 +2114,346 @@ MainProgram::CmdResult MainProgram::help_command(std::ostream& output, MatchIter
 }
 
 MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    PerftestResult result;
+    result.command_set = *begin++;
+    result.timeout = convert_string_to<unsigned int>(*begin++);
+    result.repeat_count = convert_string_to<unsigned int>(*begin++);
+//    unsigned int friend_count = convert_string_to<unsigned int>(*begin++);
+    string sizes = *begin++;
+    string format = *begin++;
+    string filename = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    if (wal_)
+    {
+        output << "Performance tests replace the data, turn the write-ahead log off first (wal off)!" << endl;
+        return {};
+    }
+
+    smatch size;
+    auto sbeg = sizes.cbegin();
+    auto send = sizes.cend();
+    for ( ; regex_search(sbeg, send, size, sizes_regex_); sbeg = size.suffix().first)
+    {
+        result.sizes.push_back(convert_string_to<unsigned int>(size[1]));
+    }
+
+    if (format.empty())
+    {
+        run_perftest(output, result);
+        return {};
+    }
+
+    ofstream file;
+    if (!filename.empty())
+    {
+        file.open(filename);
+        if (!file)
+        {
+            output << "Cannot open file '" << filename << "'!" << endl;
+            return {};
+        }
+    }
+
+    // Start from a recorded random seed, so that perfcompare can repeat exactly the same workload
+    result.seed = rand_engine_();
+    rand_engine_.seed(result.seed);
+
+    // The human-readable table is discarded if the results are printed to output
+    ostringstream dummystr;
+    run_perftest(filename.empty() ? dummystr : output, result);
+
+    ostream& resultout = filename.empty() ? output : file;
+    if (format == "json")
+    {
+        write_perftest_json(resultout, result);
+    }
+    else
+    {
+        write_perftest_csv(resultout, result);
+    }
+
+    if (!filename.empty())
+    {
+        output << "Perftest results written to '" << filename << "'" << endl;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_perfcompare(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string filename = *begin++;
+    string ratiostr = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    // Slowdowns smaller than this are considered measurement noise, whatever the ratio
+    double const min_slowdown_sec = 0.01;
+
+    double max_ratio = 1.5;
+    if (!ratiostr.empty())
+    {
+        max_ratio = convert_string_to<double>(ratiostr);
+    }
+
+    // A baseline that cannot be used fails the comparison like a regression does
+    ifstream input(filename);
+    if (!input)
+    {
+        output << "Cannot open file '" << filename << "'!" << endl;
+        test_status_ = TestStatus::DIFFS_FOUND;
+        return {};
+    }
+    PerftestResult baseline;
+    try
+    {
+        baseline = read_perftest_json(input);
+    }
+    catch (std::exception const& e)
+    {
+        output << "Invalid baseline '" << filename << "': " << e.what() << endl;
+        test_status_ = TestStatus::DIFFS_FOUND;
+        return {};
+    }
+    if (baseline.rounds.empty())
+    {
+        output << "Invalid baseline '" << filename << "': no rounds to compare to" << endl;
+        test_status_ = TestStatus::DIFFS_FOUND;
+        return {};
+    }
+
+    PerftestResult result;
+    result.command_set = baseline.command_set;
+    result.timeout = baseline.timeout;
+    result.repeat_count = baseline.repeat_count;
+    result.seed = baseline.seed;
+    result.sizes = baseline.sizes;
+    if (result.seed != 0) { rand_engine_.seed(result.seed); }
+
+    run_perftest(output, result);
+
+    output << endl << "Comparison to baseline '" << filename << "' (allowed time ratio " << max_ratio << "):" << endl;
+    output << setw(7) << "N" << " , " << setw(14) << "baseline (sec)" << " , " << setw(12) << "now (sec)"
+           << " , " << setw(8) << "ratio" << endl;
+
+    bool regressions = false;
+    for (auto& baseround : baseline.rounds)
+    {
+        output << setw(7) << baseround.n << " , " << setw(14) << baseround.total_sec << " , ";
+        auto pos = find_if(result.rounds.begin(), result.rounds.end(), [&baseround](auto const& r){ return r.n == baseround.n; });
+        if (pos == result.rounds.end())
+        {
+            output << setw(12) << "-" << " , " << setw(8) << "-" << "   <-- not completed!" << endl;
+            regressions = true;
+            continue;
+        }
+
+        double ratio = (baseround.total_sec > 0) ? pos->total_sec / baseround.total_sec : 1.0;
+        bool slower = ratio > max_ratio && pos->total_sec - baseround.total_sec > min_slowdown_sec;
+        output << setw(12) << pos->total_sec << " , " << setw(8) << ratio;
+        if (slower) { output << "   <-- slower!"; }
+        output << endl;
+        regressions = regressions || slower;
+    }
+
+    if (regressions)
+    {
+        output << "**Performance regressions found!**" << endl;
+        test_status_ = TestStatus::DIFFS_FOUND;
+    }
+    else
+    {
+        output << "**No performance regressions.**" << endl;
+        if (test_status_ == TestStatus::NOT_RUN)
+        {
+            test_status_ = TestStatus::NO_DIFFS;
+        }
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_perftest_mt(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    string threadsstr = *begin++;
+    string ratiostr = *begin++;
+    string secondsstr = *begin++;
+    string sizestr = *begin++;
+    assert(begin == end && "Invalid number of parameters");
+
+    if (wal_)
+    {
+        output << "Performance tests replace the data, turn the write-ahead log off first (wal off)!" << endl;
+        return {};
+    }
+
+    vector<unsigned int> thread_counts;
+    smatch count;
+    auto sbeg = threadsstr.cbegin();
+    auto send = threadsstr.cend();
+    for ( ; regex_search(sbeg, send, count, sizes_regex_); sbeg = count.suffix().first)
+    {
+        thread_counts.push_back(convert_string_to<unsigned int>(count[1]));
+    }
+    double read_ratio = convert_string_to<double>(ratiostr);
+    unsigned int seconds = convert_string_to<unsigned int>(secondsstr);
+    unsigned int size = convert_string_to<unsigned int>(sizestr);
+
+    if (read_ratio > 1.0)
+    {
+        output << "Read ratio must be between 0 and 1!" << endl;
+        return {};
+    }
+    if (size == 0 || std::find(thread_counts.begin(), thread_counts.end(), 0) != thread_counts.end())
+    {
+        output << "Number of threads and places must be positive!" << endl;
+        return {};
+    }
+
+    ds_.clear_all();
+    init_primes();
+    add_random_places_areas(size);
+    ds_.creation_finished();
+
+    // The workers must not touch rand_engine_ or the counters of added places, so
+    // each worker gets its own random engine and the operations only change existing
+    // places. The id/name generators n_to_...() only read the primes.
+    auto places = random_places_added_;
+    auto areas = random_areas_added_;
+    auto rnd = [](std::minstd_rand& rng, unsigned long int end) { return std::uniform_int_distribution<unsigned long int>(0, end-1)(rng); };
+    auto rnd_type = [](std::minstd_rand& rng) { return PlaceType{std::uniform_int_distribution<int>(0, static_cast<int>(PlaceType::NO_TYPE)-1)(rng)}; };
+    using WorkerOp = function<void(std::minstd_rand&)>;
+    vector<WorkerOp> const readops =
+    {
+        [&](std::minstd_rand& rng) { ds_.get_place_name_type(n_to_placeid(rnd(rng, places))); },
+        [&](std::minstd_rand& rng) { ds_.get_place_coord(n_to_placeid(rnd(rng, places))); },
+        [&](std::minstd_rand& rng) { ds_.find_places_name(n_to_name(rnd(rng, places))); },
+        [&](std::minstd_rand& rng) { ds_.find_places_type(rnd_type(rng)); },
+        [&](std::minstd_rand& rng) { ds_.places_closest_to({static_cast<int>(rnd(rng, 10000)), static_cast<int>(rnd(rng, 10000))}, rnd_type(rng)); },
+        [&](std::minstd_rand& rng) { ds_.get_area_name(n_to_areaid(rnd(rng, areas))); },
+        [&](std::minstd_rand& rng) { ds_.subarea_in_areas(n_to_areaid(rnd(rng, areas))); },
+        [&](std::minstd_rand& rng) { ds_.all_subareas_in_area(n_to_areaid(rnd(rng, areas))); },
+        [&](std::minstd_rand& rng) { ds_.common_area_of_subareas(n_to_areaid(rnd(rng, areas)), n_to_areaid(rnd(rng, areas))); },
+    };
+    // The sorted listings update the sort caches of Datastructures, so they need
+    // exclusive access like the real modifying operations
+    vector<WorkerOp> const writeops =
+    {
+        [&](std::minstd_rand& rng) { ds_.change_place_name(n_to_placeid(rnd(rng, places)), n_to_name(rnd(rng, places))); },
+        [&](std::minstd_rand& rng) { ds_.change_place_coord(n_to_placeid(rnd(rng, places)), {static_cast<int>(rnd(rng, 10000)), static_cast<int>(rnd(rng, 10000))}); },
+        [&](std::minstd_rand&) { ds_.places_alphabetically(); },
+        [&](std::minstd_rand&) { ds_.places_coord_order(); },
+    };
+
+    // The operation statistics (DATASTRUCTURES_STATS) are not thread-safe, so then
+    // also readers have to run one at a time
+    bool const exclusive_reads = Datastructures::stats_enabled();
+    std::shared_mutex ds_mutex;
+    std::atomic<bool> stop_workers{false};
+
+    output << "Perftest with " << size << " places, read ratio " << read_ratio << ", " << seconds << " sec for each thread count." << endl;
+    if (exclusive_reads) { output << "WARNING: Operation statistics enabled, reads are not run concurrently!" << endl; }
+    output << setw(7) << "threads" << " , " << setw(12) << "ops/sec" << " , " << setw(12) << "reads/sec" << " , " << setw(12) << "writes/sec"
+           << " , " << setw(10) << "speedup" << " , " << setw(10) << "efficiency" << endl;
+    flush_output(output);
+
+    double base_per_thread = 0; // Throughput per thread with the first thread count
+    for (auto threads : thread_counts)
+    {
+        vector<unsigned long long int> reads(threads, 0);
+        vector<unsigned long long int> writes(threads, 0);
+        vector<std::thread> workers;
+        stop_workers = false;
+
+        Stopwatch stopwatch;
+        stopwatch.start();
+        for (unsigned int t = 0; t < threads; ++t)
+        {
+            workers.emplace_back([&, t, seed = rand_engine_()]
+            {
+                std::minstd_rand rng(seed);
+                std::uniform_real_distribution<double> kind(0.0, 1.0);
+                unsigned long long int myreads = 0; // Counted locally to avoid false sharing
+                unsigned long long int mywrites = 0;
+                while (!stop_workers.load(std::memory_order_relaxed))
+                {
+                    if (kind(rng) < read_ratio)
+                    {
+                        auto& op = readops[rnd(rng, readops.size())];
+                        if (exclusive_reads)
+                        {
+                            std::unique_lock<std::shared_mutex> lock(ds_mutex);
+                            op(rng);
+                        }
+                        else
+                        {
+                            std::shared_lock<std::shared_mutex> lock(ds_mutex);
+                            op(rng);
+                        }
+                        ++myreads;
+                    }
+                    else
+                    {
+                        auto& op = writeops[rnd(rng, writeops.size())];
+                        std::unique_lock<std::shared_mutex> lock(ds_mutex);
+                        op(rng);
+                        ++mywrites;
+                    }
+                }
+                reads[t] = myreads;
+                writes[t] = mywrites;
+            });
+        }
+
+        bool stopped = false;
+        while (stopwatch.elapsed() < seconds && !(stopped = check_stop()))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        stop_workers = true;
+        for (auto& worker : workers) { worker.join(); }
+        stopwatch.stop();
+
+        if (stopped)
+        {
+            output << "Stopped!" << endl;
+            break;
+        }
+
+        auto sec = stopwatch.elapsed();
+        double readrate = std::accumulate(reads.begin(), reads.end(), 0ull) / sec;
+        double writerate = std::accumulate(writes.begin(), writes.end(), 0ull) / sec;
+        double rate = readrate + writerate;
+        if (base_per_thread == 0) { base_per_thread = rate / threads; }
+        double speedup = rate / (base_per_thread > 0 ? base_per_thread : 1);
+
+        output << setw(7) << threads << " , " << setw(12) << rate << " , " << setw(12) << readrate << " , " << setw(12) << writerate
+               << " , " << setw(10) << speedup << " , " << setw(10) << speedup / threads << endl;
+        flush_output(output);
+    }
+
+    ds_.clear_all();
+    init_primes();
+    view_dirty = true;
+
+    return {};
+}
+
+void MainProgram::run_perftest(std::ostream& output, PerftestResult& result)
 {
 #ifdef _GLIBCXX_DEBUG
     output << "WARNING: Debug STL enabled, performance will be worse than expected (maybe also asymptotically)!" << endl;
 #endif // _GLIBCXX_DEBUG
 
     vector<string> optional_cmds({"all_subareas_in_area", "places_closest_to", "remove_place", "common_area_of_subareas"});
-    vector<string> nondefault_cmds({"remove_place", "find_places_name", "find_places_type"});
+    vector<string> nondefault_cmds({"remove_place", "find_places_name", "find_places_type", "areas_containing",
+                                    "places_in_area", "areas_of_place", "area_stats",
+                                    "places_alphabetically_page", "places_coord_order_page"});
 
-    string commandstr = *begin++;
-    unsigned int timeout = convert_string_to<unsigned int>(*begin++);
-    unsigned int repeat_count = convert_string_to<unsigned int>(*begin++);
-//    unsigned int friend_count = convert_string_to<unsigned int>(*begin++);
-    string sizes = *begin++;
-    assert(begin == end && "Invalid number of parameters");
+    string const& commandstr = result.command_set;
+    unsigned int timeout = result.timeout;
+    unsigned int repeat_count = result.repeat_count;
 
     vector<string> testcmds;
     bool additional_get_cmds = true;
@@ -1130,21 +2469,12 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
         }
     }
 
-    vector<unsigned int> init_ns;
-    smatch size;
-    auto sbeg = sizes.cbegin();
-    auto send = sizes.cend();
-    for ( ; regex_search(sbeg, send, size, sizes_regex_); sbeg = size.suffix().first)
-    {
-        init_ns.push_back(convert_string_to<unsigned int>(size[1]));
-    }
-
     output << "Timeout for each N is " << timeout << " sec. " << endl;
 //    output << "Add 0.." << friend_count << " friends for every employee." << endl;
     output << "For each N perform " << repeat_count << " random command(s) from:" << endl;
 
     // Initialize test functions
-    vector<void(MainProgram::*)()> testfuncs;
+    vector<pair<string, void(MainProgram::*)()>> testfuncs;
     if (testcmds.empty())
     { // Add all commands
         for (auto& i : cmds_)
@@ -1155,7 +2485,7 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
                     (commandstr == "all" || find(optional_cmds.begin(), optional_cmds.end(), i.cmd) == optional_cmds.end()))
                 {
                     output << i.cmd << " ";
-                    testfuncs.push_back(i.testfunc);
+                    testfuncs.push_back({i.cmd, i.testfunc});
                 }
             }
         }
@@ -1168,7 +2498,7 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
             if (pos != cmds_.end() && pos->testfunc)
             {
                 output << i << " ";
-                testfuncs.push_back(pos->testfunc);
+                testfuncs.push_back({i, pos->testfunc});
             }
             else
             {
@@ -1181,14 +2511,34 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
     if (testfuncs.empty())
     {
         output << "No commands to test!" << endl;
-        return {};
+        result.complete = false;
+        return;
     }
 
-    output << setw(7) << "N" << " , " << setw(12) << "add (sec)" << " , " << setw(12) << "cmds (sec)"  << " , " << setw(12) << "total (sec)" << endl;
+    bool memory_stats = heap_counting_enabled() || mempeak().first != 0;
+
+    output << setw(7) << "N" << " , " << setw(12) << "add (sec)" << " , " << setw(12) << "cmds (sec)"  << " , " << setw(12) << "total (sec)";
+    if (memory_stats)
+    {
+        output << " , " << setw(12) << "heap (kB)" << " , " << setw(14) << "peak heap (kB)" << " , " << setw(12) << "bytes/place"
+               << " , " << setw(13) << "peak RSS (kB)";
+    }
+    output << endl;
     flush_output(output);
 
+    std::unique_ptr<PerfCounters> counters;
+    if (perfcounters_)
+    {
+        counters = std::make_unique<PerfCounters>();
+        if (!counters->available())
+        {
+            output << "Performance counters not available (" << counters->error() << ")" << endl;
+            counters.reset();
+        }
+    }
+
     auto stop = false;
-    for (unsigned int n : init_ns)
+    for (unsigned int n : result.sizes)
     {
         if (stop) { break; }
 
@@ -1197,6 +2547,10 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
         ds_.clear_all();
         init_primes();
 
+        reset_mempeak();
+        reset_heap_peak();
+        auto heapstart = heap_live_bytes();
+
         Stopwatch stopwatch;
         stopwatch.start();
 
@@ -1223,6 +2577,12 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
         if (stop) { break; }
 
         add_random_places_areas(n % 1000);
+        if (check_stop())
+        {
+            output << "Stopped!" << endl;
+            stop = true;
+            break;
+        }
 
         auto addsec = stopwatch.elapsed();
         output << setw(12) << addsec << " , " << flush;
@@ -1234,11 +2594,34 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
         }
 
         ds_.creation_finished();
+
+        // The paged listings build their order trees, and the area membership queries
+        // find the areas of all places, on their first call. That is not part of the
+        // cost of one call.
+        for (auto& testfunc : testfuncs)
+        {
+            auto& cmd = testfunc.first;
+            if (cmd == "places_alphabetically_page") { ds_.places_alphabetically(0, 0); }
+            else if (cmd == "places_coord_order_page") { ds_.places_coord_order(0, 0); }
+            else if ((cmd == "places_in_area" || cmd == "areas_of_place" || cmd == "area_stats") && random_areas_added_ > 0)
+            {
+                ds_.area_stats(n_to_areaid(0));
+            }
+        }
+
+        // Latencies of individual test function calls, one histogram per command
+        vector<LatencyHistogram> latencies(testfuncs.size());
+        Stopwatch cmdwatch;
+        if (counters) { counters->start(); }
         for (unsigned int repeat = 0; repeat < repeat_count; ++repeat)
         {
             auto cmdpos = random(testfuncs.begin(), testfuncs.end());
 
-            (this->**cmdpos)();
+            cmdwatch.reset();
+            cmdwatch.start();
+            (this->*(cmdpos->second))();
+            cmdwatch.stop();
+            latencies[cmdpos - testfuncs.begin()].add(cmdwatch.elapsed());
             if (additional_get_cmds)
             {
                 if (random_places_added_ > 0) // Don't do anything if there's no places
@@ -1254,6 +2637,12 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
                 }
             }
 
+            if (check_stop())
+            {
+                output << "Stopped!" << endl;
+                stop = true;
+                break;
+            }
             if (repeat % 10 == 0)
             {
                 stopwatch.stop();
@@ -1263,32 +2652,72 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
                     stop = true;
                     break;
                 }
-                if (check_stop())
-                {
-                    output << "Stopped!" << endl;
-                    stop = true;
-                    break;
-                }
                 stopwatch.start();
             }
         }
+        if (counters) { counters->stop(); }
         if (stop) { break; }
 
         stopwatch.stop();
         auto totalsec = stopwatch.elapsed();
         output << setw(12) << totalsec-addsec << " , " << setw(12) << totalsec;
 
-//        unsigned long int maxmem;
-//        string unit;
-//        tie(maxmem, unit) = mempeak();
-//        maxmem -=  startmem;
-//        if (maxmem != 0)
-//        {
-//            output << ", memory " << maxmem << " " << unit;
-//        }
+        PerftestRound round;
+        round.n = n;
+        round.add_sec = addsec;
+        round.cmds_sec = totalsec-addsec;
+        round.total_sec = totalsec;
+
+        if (memory_stats)
+        {
+            // Heap bytes are relative to the start of this N, so that they only contain the data added
+            round.heap_bytes = static_cast<long long int>(heap_live_bytes()) - static_cast<long long int>(heapstart);
+            round.peak_heap_bytes = static_cast<long long int>(heap_peak_bytes()) - static_cast<long long int>(heapstart);
+            round.peak_rss_kb = mempeak().first;
+            output << " , " << setw(12) << round.heap_bytes/1024 << " , " << setw(14) << round.peak_heap_bytes/1024
+                   << " , " << setw(12) << ((n > 0) ? round.heap_bytes/static_cast<long long int>(n) : 0)
+                   << " , " << setw(13) << round.peak_rss_kb;
+        }
         output << endl;
+
+        if (counters)
+        {
+            // Counts per executed command (including the additional get commands)
+            auto per_op = [&counters, repeat_count](PerfCounters::Counter counter){ return counters->value(counter) / repeat_count; };
+            output << setw(9) << "" << "per op:";
+            for (int c = 0; c < PerfCounters::COUNTER_COUNT; ++c)
+            {
+                auto counter = static_cast<PerfCounters::Counter>(c);
+                if (!counters->available(counter)) { continue; }
+                round.counters.push_back({PerfCounters::name(counter), per_op(counter)});
+                output << " " << PerfCounters::name(counter) << " " << round.counters.back().second;
+            }
+            if (counters->available(PerfCounters::CYCLES) && counters->available(PerfCounters::INSTRUCTIONS))
+            {
+                auto cycles = counters->value(PerfCounters::CYCLES);
+                auto ipc = (cycles > 0) ? counters->value(PerfCounters::INSTRUCTIONS) / cycles : 0.0;
+                round.counters.push_back({"IPC", ipc});
+                output << " IPC " << ipc;
+            }
+            output << endl;
+        }
+
+        for (unsigned int i = 0; i < testfuncs.size(); ++i)
+        {
+            auto& histogram = latencies[i];
+            if (histogram.count() == 0) { continue; }
+            round.cmds.push_back({testfuncs[i].first, histogram.count(), histogram.percentile(50), histogram.percentile(90),
+                                  histogram.percentile(99), histogram.max(), histogram.total()/histogram.count()});
+        }
+
+        print_latencies(output, round);
         flush_output(output);
+
+        result.rounds.push_back(std::move(round));
     }
+    result.complete = !stop;
+
+    print_complexity_fits(output, result);
 
     ds_.clear_all();
     init_primes();
@@ -1296,8 +2725,61 @@ MainProgram::CmdResult MainProgram::cmd_perftest(std::ostream& output, MatchIter
 #ifdef _GLIBCXX_DEBUG
     output << "WARNING: Debug STL enabled, performance will be worse than expected (maybe also asymptotically)!" << endl;
 #endif // _GLIBCXX_DEBUG
+}
 
-    return {};
+void MainProgram::print_latencies(std::ostream& output, PerftestRound const& round)
+{
+    auto usec = [](double sec){ return sec*1e6; };
+
+    output << setw(9) << "" << setw(24) << std::left << "command" << std::right << " , " << setw(9) << "count"
+           << " , " << setw(11) << "p50 (usec)" << " , " << setw(11) << "p90 (usec)"
+           << " , " << setw(11) << "p99 (usec)" << " , " << setw(11) << "max (usec)" << endl;
+    for (auto& cmd : round.cmds)
+    {
+        output << setw(9) << "" << setw(24) << std::left << cmd.cmd << std::right << " , " << setw(9) << cmd.count
+               << " , " << setw(11) << usec(cmd.p50_sec) << " , " << setw(11) << usec(cmd.p90_sec)
+               << " , " << setw(11) << usec(cmd.p99_sec) << " , " << setw(11) << usec(cmd.max_sec) << endl;
+    }
+}
+
+void MainProgram::print_complexity_fits(std::ostream& output, PerftestResult const& result)
+{
+    if (result.rounds.size() < 3) { return; } // Too few N's to say anything
+
+    // Collect the mean time per call of each command as a function of N
+    vector<pair<string, vector<pair<double, double>>>> series;
+    for (auto& round : result.rounds)
+    {
+        for (auto& cmd : round.cmds)
+        {
+            auto pos = find_if(series.begin(), series.end(), [&cmd](auto const& s){ return s.first == cmd.cmd; });
+            if (pos == series.end())
+            {
+                series.push_back({cmd.cmd, {}});
+                pos = series.end()-1;
+            }
+            pos->second.push_back({round.n, cmd.mean_sec});
+        }
+    }
+
+    output << endl << "Complexity of mean time per call (fitted over N):" << endl;
+    output << setw(9) << "" << setw(24) << std::left << "command" << std::right << " , " << setw(12) << "best fit"
+           << " , " << setw(12) << "expected" << endl;
+    for (auto& [cmd, points] : series)
+    {
+        auto fitted = fit_complexity(points);
+        auto cmdpos = find_if(cmds_.begin(), cmds_.end(), [&name=cmd](auto const& ci){ return ci.cmd == name; });
+        string estimate = (cmdpos != cmds_.end()) ? Datastructures::operation_complexity(cmdpos->operation) : "";
+
+        output << setw(9) << "" << setw(24) << std::left << cmd << std::right << " , " << setw(12) << complexity_to_string(fitted)
+               << " , " << setw(12) << (estimate.empty() ? "?" : estimate);
+        auto expected = complexity_from_string(estimate);
+        if (fitted != Complexity::UNKNOWN && expected != Complexity::UNKNOWN && fitted > expected)
+        {
+            output << "   <-- WARNING: grows faster than expected!";
+        }
+        output << endl;
+    }
 }
 
 MainProgram::CmdResult MainProgram::cmd_comment(std::ostream& /*output*/, MatchIter /*begin*/, MatchIter /*end*/)
@@ -1345,6 +2827,7 @@ bool MainProgram::command_parse_line(string inputline, ostream& output)
                 }
 
                 CmdResult result;
+                list_offset_ = 0;
                 try
                 {
                     result = (this->*(pos->func))(output, ++(match2.begin()), match2.end());
@@ -1368,25 +2851,26 @@ bool MainProgram::command_parse_line(string inputline, ostream& output)
                     case ResultType::PLACEIDLIST:
                     {
                         auto& [area, places] = std::get<CmdResultPlaceIDs>(result.second);
+                        OutputBuffer buffer(output);
                         if (area != NO_AREA)
                         {
-                            output << "Area: ";
-                            print_area(area, output);
+                            buffer << "Area: ";
+                            print_area(area, buffer);
                         }
                         if (!places.empty())
                         {
                             if (places.size() == 1 && places.front() == NO_PLACE)
                             {
-                                output << "Failed (NO_... returned)!!" << std::endl;
+                                buffer << "Failed (NO_... returned)!!" << '\n';
                             }
                             else
                             {
-                                unsigned int num = 0;
+                                auto num = list_offset_;
                                 for (PlaceID id : places)
                                 {
                                     ++num;
-                                    if (places.size() > 1) { output << num << ". "; }
-                                    print_place(id, output);
+                                    if (places.size() > 1 || list_offset_ > 0) { buffer << num << ". "; }
+                                    print_place(id, buffer);
                                 }
                             }
                         }
@@ -1395,11 +2879,12 @@ bool MainProgram::command_parse_line(string inputline, ostream& output)
                     case ResultType::AREAIDLIST:
                     {
                         auto& areas = std::get<CmdResultAreaIDs>(result.second);
+                        OutputBuffer buffer(output);
                         if (!areas.empty())
                         {
                             if (areas.size() == 1 && areas.front() == NO_AREA)
                             {
-                                output << "Failed (NO_... returned)!!" << std::endl;
+                                buffer << "Failed (NO_... returned)!!" << '\n';
                             }
                             else
                             {
@@ -1407,8 +2892,8 @@ bool MainProgram::command_parse_line(string inputline, ostream& output)
                                 for (auto area : areas)
                                 {
                                     ++num;
-                                    if (areas.size() > 1) { output << num << ". "; }
-                                    print_area(area, output);
+                                    if (areas.size() > 1) { buffer << num << ". "; }
+                                    print_area(area, buffer);
                                 }
                             }
                         }
@@ -1523,6 +3008,11 @@ void MainProgram::command_parser(istream& input, ostream& output, PromptStyle pr
         }
 
         if (!input) { break; }
+        if (check_stop())
+        {
+            output << "Stopped!" << endl;
+            break;
+        }
 
         bool cont = command_parse_line(line, output);
         view_dirty = false; // No need to keep track of individual result changes
@@ -1556,17 +3046,6 @@ void MainProgram::flush_output(std::ostream& /*output*/)
 }
 #endif
 
-bool MainProgram::check_stop() const
-{
-#ifdef GRAPHICAL_GUI
-    if (ui_)
-    {
-        return ui_->check_stop_pressed();
-    }
-#endif
-    return false;
-}
-
 std::array<unsigned long int, 20> const MainProgram::primes1{4943,   4951,   4957,   4967,   4969,   4973,   4987,   4993,   4999,   5003,
                                                              5009,   5011,   5021,   5023,   5039,   5051,   5059,   5077,   5081,   5087};
 std::array<unsigned long int, 20> const MainProgram::primes2{81031,  81041,  81043,  81047,  81049,  81071,  81077,  81083,  81097,  81101,
@@ -1576,8 +3055,6 @@ MainProgram::MainProgram()
 {
     rand_engine_.seed(time(nullptr));
 
-    //    startmem = get<0>(mempeak());
-
     init_primes();
     init_regexs();
 }
@@ -1726,9 +3203,18 @@ void MainProgram::init_regexs()
     {
         cmds_regex_str += (first ? "" : "|") + cmd.cmd;
         first = false;
-
-        cmd.param_regex = regex(cmd.param_regex_str+"[[:space:]]*", std::regex_constants::ECMAScript | std::regex_constants::optimize);
     }
+
+    // The parameter regexes are in the shared command table, so they are only
+    // created by the first instance (instances may be created in parallel)
+    static std::once_flag param_regexs_created;
+    std::call_once(param_regexs_created, []()
+    {
+        for (auto& cmd : cmds_)
+        {
+            cmd.param_regex = regex(cmd.param_regex_str+"[[:space:]]*", std::regex_constants::ECMAScript | std::regex_constants::optimize);
+        }
+    });
     cmds_regex_str += ")(?:[[:space:]]*$|"+wsx+"(.*))";
     cmds_regex_ = regex(cmds_regex_str, std::regex_constants::ECMAScript | std::regex_constants::optimize);
     coords_regex_ = regex(coordx+"[[:space:]]?", std::regex_constants::ECMAScript | std::regex_constants::optimize);
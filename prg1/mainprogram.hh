@@ -2,7 +2,9 @@
 #define MAINPROGRAM_HH
 
 
-#ifdef QT_CORE_LIB
+// GRAPHICAL_GUI is defined by prg1.pro for the Qt build. If the program is
+// built with Qt by other means, detect it here.
+#if defined(QT_CORE_LIB) && !defined(GRAPHICAL_GUI)
 #define GRAPHICAL_GUI
 #endif
 
@@ -20,10 +22,20 @@
 #include <utility>
 #include <variant>
 #include <bitset>
+#include <charconv>
+#include <type_traits>
+#include <memory>
+#include <atomic>
+#include <cassert>
 
 #include "datastructures.hh"
+#include "trace.hh"
+#include "wal.hh"
+#include "changefeed.hh"
 
 class MainWindow; // In case there's UI
+struct PerftestResult;
+struct PerftestRound;
 
 class MainProgram
 {
@@ -32,6 +44,7 @@ public:
 
 
     class Stopwatch;
+    class OutputBuffer;
 
     enum class PromptStyle { NORMAL, NO_ECHO, NO_NESTING };
     enum class TestStatus { NOT_RUN, NO_DIFFS, DIFFS_FOUND };
@@ -42,13 +55,26 @@ public:
     void setui(MainWindow* ui);
 
     void flush_output(std::ostream& output);
-    bool check_stop() const;
+
+    // Cancellation of a running command. Safe to call from another thread than
+    // the one running the command (e.g. the GUI thread). A program that runs
+    // part of a command of its stop parent (e.g. one file of testread_all) is
+    // stopped when the parent is.
+    void request_stop() { stop_requested_ = true; }
+    void clear_stop() { stop_requested_ = false; }
+    bool check_stop() const
+    {
+        return stop_requested_.load(std::memory_order_relaxed) || (stop_parent_ && stop_parent_->check_stop());
+    }
+    void set_stop_parent(MainProgram const* parent) { stop_parent_ = parent; }
 
     static int mainprogram(int argc, char* argv[]);
 
 private:
     Datastructures ds_;
     MainWindow* ui_ = nullptr;
+    std::atomic<bool> stop_requested_{false};
+    MainProgram const* stop_parent_ = nullptr;
 
     static std::string const PROMPT;
 
@@ -71,12 +97,28 @@ private:
     enum class StopwatchMode { OFF, ON, NEXT };
     StopwatchMode stopwatch_mode = StopwatchMode::OFF;
 
+    bool perfcounters_ = false; // Measure hardware performance counters in perftest
+
+    std::unique_ptr<TraceWriter> trace_; // Records Datastructures operations of commands, if not null
+    TraceHeader trace_header();
+    void replay_record(TraceRecord const& record);
+
+    // Write-ahead log of mutations, if not null. The log contains the changes
+    // made after the snapshot in wal_snapshot_ was written.
+    std::unique_ptr<WriteAheadLog> wal_;
+    std::string wal_snapshot_;
+    void record_mutation(TraceRecord const& record); // Successful change, to trace_ and wal_
+    std::vector<TraceRecord> snapshot_records();
+
+    ChangeFeed::Cursor changes_cursor_; // Position of the changes command in the change feed
+
     enum class ResultType { NOTHING, PLACEIDLIST, AREAIDLIST, ROUTE, WAYS };
     using CmdResultPlaceIDs = std::pair<AreaID, std::vector<PlaceID>>;
     using CmdResultAreaIDs = std::vector<AreaID>;
     using CmdResultRoute = std::vector<std::tuple<Coord, Coord, WayID, Distance>>;
     using CmdResult = std::pair<ResultType, std::variant<CmdResultPlaceIDs, CmdResultAreaIDs, CmdResultRoute>>;
     CmdResult prev_result;
+    std::size_t list_offset_ = 0; // Numbering of the printed place list starts from list_offset_+1
     bool view_dirty = true;
 
     TestStatus test_status_ = TestStatus::NOT_RUN;
@@ -89,6 +131,8 @@ private:
         std::string param_regex_str;
         CmdResult(MainProgram::*func)(std::ostream& output, MatchIter begin, MatchIter end);
         void(MainProgram::*testfunc)();
+        // Operation testfunc measures, for its expected complexity (Datastructures::operation_complexity)
+        Datastructures::Operation operation = Datastructures::Operation::OPERATION_COUNT;
         std::regex param_regex = {};
     };
     static std::vector<CmdInfo> cmds_;
@@ -121,14 +165,30 @@ private:
     CmdResult cmd_subarea_in_areas(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_all_subareas_in_area(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_places_closest_to(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_areas_containing(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_places_in_area(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_areas_of_place(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_area_stats(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_infer_subareas(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_common_area_of_subareas(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_remove_place(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_random_add(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_randseed(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_read(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_testread(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_testread_all(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_stopwatch(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_perfcounters(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_stats(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_record(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_replay(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_wal(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_checkpoint(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_apply_batch(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_changes(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_perftest(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_perfcompare(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_perftest_mt(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_comment(std::ostream& output, MatchIter begin, MatchIter end);
 
     void test_random_add();
@@ -144,6 +204,14 @@ private:
     void test_places_closest_to();
     void test_remove_place();
     void test_common_area_of_subareas();
+    void test_areas_containing();
+    void test_places_in_area();
+    void test_areas_of_place();
+    void test_area_stats();
+
+    void run_perftest(std::ostream& output, PerftestResult& result);
+    void print_latencies(std::ostream& output, PerftestRound const& round);
+    void print_complexity_fits(std::ostream& output, PerftestResult const& result);
 
     void add_random_places_areas(unsigned int size, Coord min = {1,1}, Coord max = {10000, 10000});
     std::string print_place(PlaceID id, std::ostream& output, bool nl = true);
@@ -151,6 +219,10 @@ private:
     std::string print_area(AreaID id, std::ostream& output, bool nl = true);
     std::string print_way(WayID id, std::ostream& output, bool nl = true);
     std::string print_coord(Coord coord, std::ostream& output, bool nl = true);
+    // Buffered versions of the above, used when printing long result lists
+    void print_place(PlaceID id, OutputBuffer& output, bool nl = true);
+    void print_area(AreaID id, OutputBuffer& output, bool nl = true);
+    void print_coord(Coord coord, OutputBuffer& output, bool nl = true);
 
     template <typename Type>
     Type random(Type start, Type end);
@@ -165,7 +237,7 @@ private:
     template<PlaceID(Datastructures::*MFUNC)()>
     CmdResult NoParPlaceCmd(std::ostream& output, MatchIter begin, MatchIter end);
 
-    template<std::vector<PlaceID>(Datastructures::*MFUNC)()>
+    template<std::vector<PlaceID>(Datastructures::*MFUNC)(), TraceOp OP>
     CmdResult NoParPlaceListCmd(std::ostream& output, MatchIter begin, MatchIter end);
 
     template<PlaceID(Datastructures::*MFUNC)()>
@@ -174,6 +246,12 @@ private:
     template<std::vector<PlaceID>(Datastructures::*MFUNC)()>
     void NoParPlaceListTestCmd();
 
+    template<std::vector<PlaceID>(Datastructures::*MFUNC)(std::size_t, std::size_t), TraceOp OP>
+    CmdResult PagedPlaceListCmd(std::ostream& output, MatchIter begin, MatchIter end);
+
+    template<std::vector<PlaceID>(Datastructures::*MFUNC)(std::size_t, std::size_t)>
+    void PagedPlaceListTestCmd();
+
     friend class MainWindow;
 };
 
@@ -220,9 +298,10 @@ MainProgram::CmdResult MainProgram::NoParPlaceCmd(std::ostream& /*output*/, Matc
     return {ResultType::PLACEIDLIST, MainProgram::CmdResultPlaceIDs{NO_AREA, {result}}};
 }
 
-template<std::vector<PlaceID>(Datastructures::*MFUNC)()>
+template<std::vector<PlaceID>(Datastructures::*MFUNC)(), TraceOp OP>
 MainProgram::CmdResult MainProgram::NoParPlaceListCmd(std::ostream& output, MatchIter /*begin*/, MatchIter /*end*/)
 {
+    if (trace_) { trace_->write({OP}); }
     auto result = (ds_.*MFUNC)();
     if (result.empty())
     {
@@ -243,6 +322,38 @@ void MainProgram::NoParPlaceListTestCmd()
     (ds_.*MFUNC)();
 }
 
+template<std::vector<PlaceID>(Datastructures::*MFUNC)(std::size_t, std::size_t), TraceOp OP>
+MainProgram::CmdResult MainProgram::PagedPlaceListCmd(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    std::string offsetstr = *begin++;
+    std::string limitstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto offset = convert_string_to<std::size_t>(offsetstr);
+    auto limit = convert_string_to<std::size_t>(limitstr);
+
+    if (trace_) { trace_->write({OP, static_cast<long long int>(offset), static_cast<long long int>(limit)}); }
+    auto result = (ds_.*MFUNC)(offset, limit);
+    if (result.empty())
+    {
+        output << "No Places!" << std::endl;
+        return {};
+    }
+    output << "Places " << offset+1 << "-" << offset+result.size() << " of " << ds_.place_count() << ":" << std::endl;
+    list_offset_ = offset;
+    return {ResultType::PLACEIDLIST, MainProgram::CmdResultPlaceIDs{NO_AREA, result}};
+}
+
+template<std::vector<PlaceID>(Datastructures::*MFUNC)(std::size_t, std::size_t)>
+void MainProgram::PagedPlaceListTestCmd()
+{
+    auto count = ds_.place_count();
+    if (count > 0) // Don't do anything if there's no places
+    {
+        (ds_.*MFUNC)(random<std::size_t>(0, static_cast<std::size_t>(count)), 50);
+    }
+}
+
 
 class MainProgram::Stopwatch
 {
@@ -270,5 +381,55 @@ private:
     bool running_ = false;
 };
 
+// Collects formatted output into a large string buffer, which is written to
+// the underlying stream only when it fills up or when the buffer is destroyed.
+// Does not flush the stream itself, so printing a long list of results costs
+// a handful of write calls instead of one flush per line (as with std::endl).
+class MainProgram::OutputBuffer
+{
+public:
+    static std::size_t const DEFAULT_CAPACITY = 64*1024;
+
+    explicit OutputBuffer(std::ostream& output, std::size_t capacity = DEFAULT_CAPACITY)
+        : output_(output), capacity_(capacity) {}
+    ~OutputBuffer() { flush(); }
+
+    OutputBuffer(OutputBuffer const&) = delete;
+    OutputBuffer& operator=(OutputBuffer const&) = delete;
+
+    OutputBuffer& operator<<(char c) { buffer_.push_back(c); return flush_if_full(); }
+    OutputBuffer& operator<<(char const* str) { buffer_.append(str); return flush_if_full(); }
+    OutputBuffer& operator<<(std::string const& str) { buffer_.append(str); return flush_if_full(); }
+
+    template <typename Int, typename = std::enable_if_t<std::is_integral_v<Int>>>
+    OutputBuffer& operator<<(Int value)
+    {
+        char digits[24]; // Enough for any 64-bit integer with sign
+        auto result = std::to_chars(digits, digits+sizeof(digits), value);
+        buffer_.append(digits, result.ptr);
+        return flush_if_full();
+    }
+
+    void flush()
+    {
+        if (!buffer_.empty())
+        {
+            output_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+            buffer_.clear();
+        }
+    }
+
+private:
+    OutputBuffer& flush_if_full()
+    {
+        if (buffer_.size() >= capacity_) { flush(); }
+        return *this;
+    }
+
+    std::ostream& output_;
+    std::size_t capacity_;
+    std::string buffer_;
+};
+
 
 #endif // MAINPROGRAM_HH
@@ -21,6 +21,9 @@
 #include <QPen>
 #include <QGraphicsItem>
 #include <QVariant>
+#include <QPainterPath>
+#include <QThread>
+#include <QScrollBar>
 
 #include <string>
 using std::string;
@@ -35,6 +38,9 @@ using std::ostringstream;
 #include <algorithm>
 #include <utility>
 #include <tuple>
+#include <array>
+#include <cmath>
+#include <numeric>
 
 #include <cassert>
 
@@ -52,6 +58,29 @@ Q_DECLARE_METATYPE(WayID)
 // The same for Coords (currently a pair of ints)
 Q_DECLARE_METATYPE(Coord)
 
+namespace
+{
+// Drops polygon vertices that are closer than tolerance to the previous kept
+// vertex, so that zoomed out areas are drawn with a handful of lines
+std::vector<Coord> simplify_polygon(ListView<Coord> coords, double tolerance)
+{
+    std::vector<Coord> result;
+    for (auto xy : coords)
+    {
+        if (result.empty() || std::hypot(xy.x - result.back().x, xy.y - result.back().y) >= tolerance)
+        {
+            result.push_back(xy);
+        }
+    }
+    // The loop is closed back to the first vertex, so drop a last vertex too close to it
+    if (result.size() > 1 && std::hypot(result.back().x - result.front().x, result.back().y - result.front().y) < tolerance)
+    {
+        result.pop_back();
+    }
+    return result;
+}
+}
+
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow)
@@ -101,11 +130,22 @@ MainWindow::MainWindow(QWidget *parent) :
 //    connect(this, &MainProgram::signal_clear_selection, this, &MainProgram::clear_selection);
 
     // Zoom slider changes graphics view scale
-    connect(ui->zoom_plus, &QToolButton::clicked, [this]{ this->ui->graphics_view->scale(1.1, 1.1); });
-    connect(ui->zoom_minus, &QToolButton::clicked, [this]{ this->ui->graphics_view->scale(1/1.1, 1/1.1); });
-    connect(ui->zoom_1, &QToolButton::clicked, [this]{ this->ui->graphics_view->resetTransform(); });
+    connect(ui->zoom_plus, &QToolButton::clicked, [this]{ this->ui->graphics_view->scale(1.1, 1.1); this->view_update_timer_->start(); });
+    connect(ui->zoom_minus, &QToolButton::clicked, [this]{ this->ui->graphics_view->scale(1/1.1, 1/1.1); this->view_update_timer_->start(); });
+    connect(ui->zoom_1, &QToolButton::clicked, [this]{ this->ui->graphics_view->resetTransform(); this->view_update_timer_->start(); });
     connect(ui->zoom_fit, &QToolButton::clicked, this, &MainWindow::fit_view);
 
+    // Only the visible part of the map is drawn, so panning and zooming update the view
+    // (after the movement has paused for a moment)
+    view_update_timer_ = new QTimer(this);
+    view_update_timer_->setSingleShot(true);
+    view_update_timer_->setInterval(50);
+    connect(view_update_timer_, &QTimer::timeout, this, &MainWindow::update_view);
+    connect(ui->graphics_view->horizontalScrollBar(), &QScrollBar::valueChanged,
+            view_update_timer_, static_cast<void(QTimer::*)()>(&QTimer::start));
+    connect(ui->graphics_view->verticalScrollBar(), &QScrollBar::valueChanged,
+            view_update_timer_, static_cast<void(QTimer::*)()>(&QTimer::start));
+
     // Changing checkboxes updates view
     connect(ui->ways_checkbox, &QCheckBox::clicked, this, &MainWindow::update_view);
     connect(ui->xroads_checkbox, &QCheckBox::clicked, this, &MainWindow::update_view);
@@ -134,13 +174,18 @@ MainWindow::MainWindow(QWidget *parent) :
     connect(ui->clear_input_button, &QPushButton::clicked, this, &MainWindow::clear_input_line);
 
     // Stop button
-    connect(ui->stop_button, &QPushButton::clicked, [this](){ this->stop_pressed_ = true; });
+    connect(ui->stop_button, &QPushButton::clicked, [this](){ this->mainprg_.request_stop(); });
 
     clear_input_line();
 }
 
 MainWindow::~MainWindow()
 {
+    if (command_thread_.joinable())
+    {
+        mainprg_.request_stop();
+        command_thread_.join();
+    }
     delete ui;
 }
 
@@ -148,7 +193,9 @@ void MainWindow::update_view()
 {
 //    ui->output->appendPlainText("Update view:");
 
-    gscene_->clear();
+    if (command_running_) { return; } // View is updated when the command has finished
+
+    ++view_generation_;
     auto pointscale = ui->pointscale->value();
     auto fontscale = ui->fontscale->value();
     bool errors = false;
@@ -169,22 +216,66 @@ void MainWindow::update_view()
         result_route = std::get<MainProgram::CmdResultRoute>(mainprg_.prev_result.second);
     }
 
+    // Scene rectangle covers all data, so that the view can be panned to parts that have no items yet
+    auto [datamin, datamax] = mainprg_.ds_.bounding_box();
+    if (datamin != NO_COORD)
+    {
+        gscene_->setSceneRect(QRectF(QPointF(20*datamin.x, -20*datamax.y), QPointF(20*datamax.x, -20*datamin.y)).adjusted(-100, -100, 100, 100));
+    }
+
+    // Visible part of the map in place coordinates (scene coordinates are (20*x, -20*y)), extended
+    // by half a view in every direction so that small pans don't immediately need new items
+    auto view = ui->graphics_view;
+    auto visible = view->mapToScene(view->viewport()->rect()).boundingRect();
+    visible.adjust(-visible.width()/2, -visible.height()/2, visible.width()/2, visible.height()/2);
+    auto to_coord = [](double scenepos){ return static_cast<int>(std::max(-1e9, std::min(1e9, scenepos/20))); };
+    Coord viewmin = {to_coord(std::floor(visible.left())), to_coord(-std::ceil(visible.bottom()))};
+    Coord viewmax = {to_coord(std::ceil(visible.right())), to_coord(-std::floor(visible.top()))};
+    double pixels_per_unit = 20 * view->transform().m11();
+
+    // Level of detail: when zoomed out so far that too many places would be visible, draw the
+    // density of places instead (and only the places in the result of the previous command)
+    int columns = std::max(1, static_cast<int>(visible.width() * view->transform().m11() / DENSITY_CELL_PIXELS));
+    int rows = std::max(1, static_cast<int>(visible.height() * view->transform().m22() / DENSITY_CELL_PIXELS));
+    std::vector<int> density;
+    bool show_density = false;
+    if (ui->places_checkbox->isChecked())
+    {
+        density = mainprg_.ds_.place_density(viewmin, viewmax, columns, rows);
+        show_density = std::accumulate(density.begin(), density.end(), 0LL) > MAX_PLACE_ITEMS;
+    }
+    update_density_items(viewmin, viewmax, columns, rows, show_density ? density : std::vector<int>{});
+
+    // All place items have to be recreated if their size changes
+    if (pointscale != items_pointscale_ || fontscale != items_fontscale_)
+    {
+        remove_place_items();
+        items_pointscale_ = pointscale;
+        items_fontscale_ = fontscale;
+    }
 
     if (ui->places_checkbox->isChecked())
     {
-        auto places = mainprg_.ds_.all_places();
-        if (!errors && places.size() == 1 && places.front() == NO_PLACE)
+        std::vector<PlaceID> places;
+        if (show_density)
         {
-            errorout << "Error from GUI: all_places() returned error {NO_PLACE}" << std::endl;
-            errors = true;
+            for (auto& [placeid, prefix] : result_places)
+            {
+                auto xy = mainprg_.ds_.get_place_coord(placeid);
+                if (xy != NO_COORD && xy.x >= viewmin.x && xy.x <= viewmax.x && xy.y >= viewmin.y && xy.y <= viewmax.y)
+                {
+                    places.push_back(placeid);
+                }
+            }
+        }
+        else
+        {
+            places = mainprg_.ds_.places_in_rect(viewmin, viewmax);
         }
 
         for (auto placeid : places)
         {
-            QColor placecolor = Qt::white;
-            QColor namecolor = Qt::cyan;
-            QColor placeborder = Qt::white;
-            int placezvalue = 1;
+            ItemLook look = ItemLook::NORMAL;
 
             auto xy = mainprg_.ds_.get_place_coord(placeid);
             auto [x,y] = xy;
@@ -205,72 +296,65 @@ void MainWindow::update_view()
                 errors = true;
             }
 
-            if (x == NO_VALUE || y == NO_VALUE)
-            {
-                x = 0; y = 0;
-                placecolor = Qt::magenta;
-                namecolor = Qt::magenta;
-                placezvalue = 30;
-            }
-
             string prefix;
             auto res_place = result_places.find(placeid);
             if (res_place != result_places.end())
             {
                 if (result_places.size() > 1) { prefix = res_place->second; }
-                namecolor = Qt::red;
-                placeborder = Qt::red;
-                placezvalue = 2;
+                look = ItemLook::RESULT;
             }
 
-            if (ui->places_checkbox->isChecked())
+            if (x == NO_VALUE || y == NO_VALUE)
             {
-                auto groupitem = gscene_->createItemGroup({});
-                groupitem->setFlag(QGraphicsItem::ItemIsSelectable);
-                groupitem->setData(0, QVariant::fromValue(placeid));
-
-                QPen placepen(placeborder);
-                placepen.setWidth(0); // Cosmetic pen
-                auto dotitem = gscene_->addEllipse(-4*pointscale, -4*pointscale, 8*pointscale, 8*pointscale,
-                                                   placepen, QBrush(placecolor));
-                dotitem->setFlag(QGraphicsItem::ItemIgnoresTransformations);
-                groupitem->addToGroup(dotitem);
-                //        dotitem->setFlag(QGraphicsItem::ItemIgnoresTransformations);
-                //        dotitem->setData(0, QVariant::fromValue(town));
-
-                // Draw place names
-                string label = prefix;
-                if (ui->placenames_checkbox->isChecked())
-                {
-                    auto [name,type] = mainprg_.ds_.get_place_name_type(placeid);
-                    if (!errors && name == NO_NAME)
-                    {
-                        errorout << "GUI error: get_stop_name(" << placeid << ") returned error {NO_NAME}" << std::endl;
-                        errors = true;
-                    }
+                xy = {0, 0};
+                look = ItemLook::INVALID;
+            }
 
-                    label += name;
+            // Draw place names
+            string label = prefix;
+            if (ui->placenames_checkbox->isChecked())
+            {
+                auto [name,type] = mainprg_.ds_.get_place_name_type(placeid);
+                if (!errors && name == NO_NAME)
+                {
+                    errorout << "GUI error: get_stop_name(" << placeid << ") returned error {NO_NAME}" << std::endl;
+                    errors = true;
                 }
 
-                if (!label.empty())
+                label += name;
+            }
+
+            // Only create a new item if the place is new or has changed since the previous update
+            auto itempos = place_items_.find(placeid);
+            if (itempos != place_items_.end())
+            {
+                auto& placeitem = itempos->second;
+                if (placeitem.xy == xy && placeitem.look == look && placeitem.label == label)
                 {
-                    // Create extra item group to be able to set ItemIgnoresTransformations on the correct level (addSimpleText does not allow
-                    // setting initial coordinates in item coordinates
-                    auto textgroupitem = gscene_->createItemGroup({});
-                    auto textitem = gscene_->addSimpleText(QString::fromStdString(label));
-                    auto font = textitem->font();
-                    font.setPointSizeF(font.pointSizeF()*fontscale);
-                    textitem->setFont(font);
-                    textitem->setBrush(QBrush(namecolor));
-                    textitem->setPos(-textitem->boundingRect().width()/2, -4*pointscale - textitem->boundingRect().height());
-                    textgroupitem->addToGroup(textitem);
-                    textgroupitem->setFlag(QGraphicsItem::ItemIgnoresTransformations);
-                    groupitem->addToGroup(textgroupitem);
+                    placeitem.generation = view_generation_;
+                    continue;
                 }
-
-                groupitem->setPos(20*x, -20*y);
-                groupitem->setZValue(placezvalue);
+                gscene_->removeItem(placeitem.item);
+                delete placeitem.item;
+                place_items_.erase(itempos);
             }
+            auto item = create_place_item(placeid, xy, label, look);
+            place_items_.insert({placeid, PlaceItem{xy, std::move(label), look, item, view_generation_}});
+        }
+    }
+
+    // Remove the items of places that no longer exist (or all, if places are not shown)
+    for (auto iter = place_items_.begin(); iter != place_items_.end(); )
+    {
+        if (iter->second.generation != view_generation_)
+        {
+            gscene_->removeItem(iter->second.item);
+            delete iter->second.item;
+            iter = place_items_.erase(iter);
+        }
+        else
+        {
+            ++iter;
         }
     }
 
@@ -288,26 +372,21 @@ void MainWindow::update_view()
             resultareas.insert(prevresult.begin(), prevresult.end());
         }
 
-        auto areaids = mainprg_.ds_.all_areas();
-        if (!errors && areaids.size() == 1 && areaids.front() == NO_AREA)
-        {
-            errorout << "GUI error: all_regions() returned error {NO_REGION}" << std::endl;
-            errors = true;
-        }
+        auto areaids = mainprg_.ds_.areas_in_rect(viewmin, viewmax);
+        double simplify_tolerance = (pixels_per_unit > 0) ? AREA_SIMPLIFY_PIXELS / pixels_per_unit : 0;
 
         for (auto areaid : areaids)
         {
-            QColor areacolor = Qt::blue;
-            int areazvalue = -3;
+            ItemLook look = ItemLook::NORMAL;
 
             if (areaid != NO_AREA)
             {
                 if (resultareas.find(areaid) != resultareas.end())
                 {
-                    areacolor = Qt::green;
-                    areazvalue = -2;
+                    look = ItemLook::RESULT;
                 }
-                auto coords = mainprg_.ds_.get_area_coords(areaid);
+                // Read in place: only the simplified polygon is copied
+                auto coords = mainprg_.ds_.get_area_coords_view(areaid);
                 if (!errors && (coords.size() < 3 || std::find(coords.begin(), coords.end(), NO_COORD) != coords.end()))
                 {
                     errorout << "GUI error: get_area_coords(" << areaid << ") returned error { ";
@@ -321,32 +400,51 @@ void MainWindow::update_view()
                 }
                 else
                 {
-                    auto pen = QPen(areacolor);
-                    pen.setWidth(0); // "Cosmetic" pen
-                    Coord prevcoord = NO_COORD;
-                    for (auto& coord : coords)
+                    // Areas smaller than a few pixels are not drawn at all (unless they are in the result)
+                    auto simplified = simplify_polygon(coords, simplify_tolerance);
+                    if (simplified.empty() || (simplified.size() < 2 && look != ItemLook::RESULT)) { continue; }
+
+                    auto itempos = area_items_.find(areaid);
+                    if (itempos != area_items_.end())
                     {
-                        if (prevcoord != NO_COORD)
+                        auto& areaitem = itempos->second;
+                        if (areaitem.look == look && areaitem.coords == simplified)
+                        {
+                            areaitem.generation = view_generation_;
+                            continue;
+                        }
+                        for (auto item : areaitem.items)
                         {
-                            QLineF line(QPointF(20*prevcoord.x, -20*prevcoord.y), QPointF(20*coord.x, -20*coord.y));
-                            auto lineitem = gscene_->addLine(line, pen);
-                            lineitem->setFlag(QGraphicsItem::ItemIsSelectable);
-                            lineitem->setData(0, QVariant::fromValue(AreaIDcont{areaid}));
-                            lineitem->setZValue(areazvalue);
+                            gscene_->removeItem(item);
+                            delete item;
                         }
-                        prevcoord = coord;
+                        area_items_.erase(itempos);
                     }
-                    // Close the loop
-                    QLineF line(QPointF(20*prevcoord.x, -20*prevcoord.y), QPointF(20*coords.front().x, -20*coords.front().y));
-                    auto lineitem = gscene_->addLine(line, pen);
-                    lineitem->setFlag(QGraphicsItem::ItemIsSelectable);
-                    lineitem->setData(0, QVariant::fromValue(AreaIDcont{areaid}));
-                    lineitem->setZValue(areazvalue);
+                    auto items = create_area_items(areaid, simplified, look);
+                    area_items_.insert({areaid, AreaItem{std::move(simplified), look, std::move(items), view_generation_}});
                 }
             }
         }
     }
 
+    // Remove the items of areas that no longer exist (or all, if areas are not shown)
+    for (auto iter = area_items_.begin(); iter != area_items_.end(); )
+    {
+        if (iter->second.generation != view_generation_)
+        {
+            for (auto item : iter->second.items)
+            {
+                gscene_->removeItem(item);
+                delete item;
+            }
+            iter = area_items_.erase(iter);
+        }
+        else
+        {
+            ++iter;
+        }
+    }
+
     if (errors)
     {
         output_text(errorout);
@@ -354,15 +452,152 @@ void MainWindow::update_view()
     }
 }
 
+QGraphicsItemGroup* MainWindow::create_place_item(PlaceID id, Coord xy, std::string const& label, ItemLook look)
+{
+    auto pointscale = items_pointscale_;
+    auto fontscale = items_fontscale_;
+
+    QColor placecolor = Qt::white;
+    QColor namecolor = Qt::cyan;
+    QColor placeborder = Qt::white;
+    int placezvalue = 1;
+    if (look == ItemLook::RESULT)
+    {
+        namecolor = Qt::red;
+        placeborder = Qt::red;
+        placezvalue = 2;
+    }
+    else if (look == ItemLook::INVALID)
+    {
+        placecolor = Qt::magenta;
+        namecolor = Qt::magenta;
+        placezvalue = 30;
+    }
+
+    auto groupitem = gscene_->createItemGroup({});
+    groupitem->setFlag(QGraphicsItem::ItemIsSelectable);
+    groupitem->setData(0, QVariant::fromValue(id));
+
+    QPen placepen(placeborder);
+    placepen.setWidth(0); // Cosmetic pen
+    auto dotitem = gscene_->addEllipse(-4*pointscale, -4*pointscale, 8*pointscale, 8*pointscale,
+                                       placepen, QBrush(placecolor));
+    dotitem->setFlag(QGraphicsItem::ItemIgnoresTransformations);
+    groupitem->addToGroup(dotitem);
+
+    if (!label.empty())
+    {
+        // Create extra item group to be able to set ItemIgnoresTransformations on the correct level (addSimpleText does not allow
+        // setting initial coordinates in item coordinates
+        auto textgroupitem = gscene_->createItemGroup({});
+        auto textitem = gscene_->addSimpleText(QString::fromStdString(label));
+        auto font = textitem->font();
+        font.setPointSizeF(font.pointSizeF()*fontscale);
+        textitem->setFont(font);
+        textitem->setBrush(QBrush(namecolor));
+        textitem->setPos(-textitem->boundingRect().width()/2, -4*pointscale - textitem->boundingRect().height());
+        textgroupitem->addToGroup(textitem);
+        textgroupitem->setFlag(QGraphicsItem::ItemIgnoresTransformations);
+        groupitem->addToGroup(textgroupitem);
+    }
+
+    groupitem->setPos(20*xy.x, -20*xy.y);
+    groupitem->setZValue(placezvalue);
+
+    return groupitem;
+}
+
+std::vector<QGraphicsItem*> MainWindow::create_area_items(AreaID id, std::vector<Coord> const& coords, ItemLook look)
+{
+    QColor areacolor = (look == ItemLook::RESULT) ? Qt::green : Qt::blue;
+    int areazvalue = (look == ItemLook::RESULT) ? -2 : -3;
+
+    std::vector<QGraphicsItem*> items;
+    auto pen = QPen(areacolor);
+    pen.setWidth(0); // "Cosmetic" pen
+    auto add_line = [&](Coord from, Coord to)
+    {
+        QLineF line(QPointF(20*from.x, -20*from.y), QPointF(20*to.x, -20*to.y));
+        auto lineitem = gscene_->addLine(line, pen);
+        lineitem->setFlag(QGraphicsItem::ItemIsSelectable);
+        lineitem->setData(0, QVariant::fromValue(AreaIDcont{id}));
+        lineitem->setZValue(areazvalue);
+        items.push_back(lineitem);
+    };
+
+    for (unsigned int i = 1; i < coords.size(); ++i)
+    {
+        add_line(coords[i-1], coords[i]);
+    }
+    // Close the loop
+    add_line(coords.back(), coords.front());
+
+    return items;
+}
+
+void MainWindow::update_density_items(Coord viewmin, Coord viewmax, int columns, int rows, std::vector<int> const& density)
+{
+    for (auto item : density_items_)
+    {
+        gscene_->removeItem(item);
+        delete item;
+    }
+    density_items_.clear();
+    if (density.empty()) { return; }
+
+    // One path item per intensity level instead of an item per cell
+    std::array<QPainterPath, DENSITY_LEVELS> paths;
+    double cellwidth = (static_cast<double>(viewmax.x) - viewmin.x + 1) / columns;
+    double cellheight = (static_cast<double>(viewmax.y) - viewmin.y + 1) / rows;
+    for (int row = 0; row < rows; ++row)
+    {
+        for (int column = 0; column < columns; ++column)
+        {
+            auto count = density[static_cast<std::size_t>(row) * columns + column];
+            if (count == 0) { continue; }
+            auto level = std::min(DENSITY_LEVELS-1, static_cast<int>(std::log2(count)));
+            paths[level].addRect(QRectF(20*(viewmin.x + column*cellwidth), -20*(viewmin.y + (row+1)*cellheight),
+                                        20*cellwidth, 20*cellheight));
+        }
+    }
+
+    for (int level = 0; level < DENSITY_LEVELS; ++level)
+    {
+        if (paths[level].isEmpty()) { continue; }
+        QColor color = Qt::white;
+        color.setAlpha(40 + level*(255-40)/(DENSITY_LEVELS-1));
+        auto item = gscene_->addPath(paths[level], Qt::NoPen, QBrush(color));
+        item->setZValue(0);
+        density_items_.push_back(item);
+    }
+}
+
+void MainWindow::remove_place_items()
+{
+    for (auto& [id, placeitem] : place_items_)
+    {
+        gscene_->removeItem(placeitem.item);
+        delete placeitem.item;
+    }
+    place_items_.clear();
+}
+
 void MainWindow::output_text(ostringstream& output)
 {
     string outstr = output.str();
     if (!outstr.empty())
     {
         if (outstr.back() == '\n') { outstr.pop_back(); } // Remove trailing newline
-        ui->output->appendPlainText(QString::fromStdString(outstr));
-        ui->output->ensureCursorVisible();
-        ui->output->repaint();
+        auto text = QString::fromStdString(outstr);
+        if (QThread::currentThread() != thread())
+        {
+            // Called from the command thread, widgets may only be touched in the GUI thread
+            QMetaObject::invokeMethod(this, [this, text]{ append_output(text); }, Qt::QueuedConnection);
+        }
+        else
+        {
+            append_output(text);
+        }
     }
 
     output.str(""); // Clear the stream, because it has already been output
@@ -375,31 +610,47 @@ void MainWindow::output_text_end()
     ui->output->repaint();
 }
 
-bool MainWindow::check_stop_pressed() const
+void MainWindow::append_output(QString const& text)
 {
-    QCoreApplication::processEvents();
-    return stop_pressed_;
+    ui->output->appendPlainText(text);
+    ui->output->ensureCursorVisible();
 }
 
 void MainWindow::execute_line()
 {
+    if (command_running_) { return; } // Return pressed in the line edit while a command runs
+
     auto line = ui->lineEdit->text();
     clear_input_line();
     ui->output->appendPlainText(QString::fromStdString(MainProgram::PROMPT)+line);
 
     ui->execute_button->setEnabled(false);
     ui->stop_button->setEnabled(true);
-    stop_pressed_ = false;
+    mainprg_.clear_stop();
+    command_running_ = true;
 
-    ostringstream output;
-    bool cont = mainprg_.command_parse_line(line.toStdString(), output);
-    ui->lineEdit->clear();
-    output_text(output);
+    // The output is streamed to the GUI thread by flush_output()/output_text() as the command
+    // proceeds. Queued calls are delivered in order, so the rest of the output arrives before
+    // command_finished().
+    command_thread_ = std::thread([this, cmdline = line.toStdString()]
+    {
+        ostringstream output;
+        bool cont = mainprg_.command_parse_line(cmdline, output);
+        output_text(output);
+        QMetaObject::invokeMethod(this, [this, cont]{ command_finished(cont); }, Qt::QueuedConnection);
+    });
+}
+
+void MainWindow::command_finished(bool cont)
+{
+    command_thread_.join();
+    command_running_ = false;
     output_text_end();
 
+    ui->lineEdit->clear();
     ui->stop_button->setEnabled(false);
     ui->execute_button->setEnabled(true);
-    stop_pressed_ = false;
+    mainprg_.clear_stop();
 
     ui->lineEdit->setFocus();
 
@@ -418,6 +669,7 @@ void MainWindow::execute_line()
 
 void MainWindow::cmd_selected(int idx)
 {
+    // cmds_ is not changed after the constructor, so it can be read while a command runs
     ui->lineEdit->insert(QString::fromStdString(mainprg_.cmds_[idx].cmd+" "));
     ui->cmd_info_text->setText(QString::fromStdString(mainprg_.cmds_[idx].cmd+" "+mainprg_.cmds_[idx].info));
 
@@ -457,11 +709,26 @@ void MainWindow::clear_input_line()
 
 void MainWindow::fit_view()
 {
-    ui->graphics_view->fitInView(gscene_->itemsBoundingRect(), Qt::KeepAspectRatio);
+    if (command_running_) { return; } // bounding_box() may rebuild the spatial index the command is using
+
+    // Not all items exist (only the visible ones are drawn), so fit to the extent of the data
+    auto [min, max] = mainprg_.ds_.bounding_box();
+    if (min != NO_COORD)
+    {
+        ui->graphics_view->fitInView(QRectF(QPointF(20*min.x, -20*max.y), QPointF(20*max.x, -20*min.y)).adjusted(-20, -20, 20, 20),
+                                     Qt::KeepAspectRatio);
+    }
+    else
+    {
+        ui->graphics_view->fitInView(gscene_->itemsBoundingRect(), Qt::KeepAspectRatio);
+    }
+    update_view();
 }
 
 void MainWindow::scene_selection_change()
 {
+    if (command_running_) { return; }
+
     auto items = gscene_->selectedItems();
     if (!items.empty())
     {
@@ -13,6 +13,12 @@
 
 #include <QMainWindow>
 #include <QGraphicsScene>
+#include <QTimer>
+
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace Ui {
 class MainWindow;
@@ -27,11 +33,9 @@ public:
     ~MainWindow();
 
     void update_view();
-    void output_text(std::ostringstream &output);
+    void output_text(std::ostringstream &output); // Can also be called from the command thread
     void output_text_end();
 
-    bool check_stop_pressed() const;
-
 public slots:
     void execute_line();
     void cmd_selected(int idx);
@@ -49,9 +53,55 @@ private:
 
     MainProgram mainprg_;
 
-    bool stop_pressed_ = false;
+    // Commands are run in a separate thread, so that the GUI stays responsive. While a
+    // command runs, the GUI must not access mainprg_ other than to request stopping or to read
+    // the command table cmds_, which does not change after the constructor.
+    std::thread command_thread_;
+    bool command_running_ = false;
+    void command_finished(bool cont);
+    void append_output(QString const& text);
 
     bool selection_clear_in_progress = false;
+
+    // Graphics items of the places and areas in the scene. The items are kept
+    // between view updates, and update_view() only recreates the items whose
+    // place or area has been added, changed or removed.
+    enum class ItemLook { NORMAL, RESULT, INVALID };
+    struct PlaceItem
+    {
+        Coord xy;
+        std::string label;
+        ItemLook look;
+        QGraphicsItemGroup* item;
+        unsigned int generation; // Last update_view() that found the place
+    };
+    struct AreaItem
+    {
+        std::vector<Coord> coords;
+        ItemLook look;
+        std::vector<QGraphicsItem*> items;
+        unsigned int generation;
+    };
+    std::vector<QGraphicsItem*> density_items_; // Shown instead of places when zoomed out
+    std::unordered_map<PlaceID, PlaceItem> place_items_;
+    std::unordered_map<AreaID, AreaItem> area_items_;
+    unsigned int view_generation_ = 0;
+    double items_pointscale_ = 0; // Scales that the current place items were created with
+    double items_fontscale_ = 0;
+
+    // Level of detail: if more places than this are visible, their density is
+    // drawn instead, with cells of the given size
+    static int const MAX_PLACE_ITEMS = 5000;
+    static int const DENSITY_CELL_PIXELS = 8;
+    static int const DENSITY_LEVELS = 8;
+    static int const AREA_SIMPLIFY_PIXELS = 2; // Polygon vertices closer than this are merged
+
+    QTimer* view_update_timer_ = nullptr; // Updates the view after panning/zooming has paused
+
+    QGraphicsItemGroup* create_place_item(PlaceID id, Coord xy, std::string const& label, ItemLook look);
+    std::vector<QGraphicsItem*> create_area_items(AreaID id, std::vector<Coord> const& coords, ItemLook look);
+    void remove_place_items();
+    void update_density_items(Coord viewmin, Coord viewmax, int columns, int rows, std::vector<int> const& density);
 };
 
 #endif // MAINWINDOW_HH
@@ -0,0 +1,210 @@
+// Ordertree.hh
+//
+// Order-statistic tree: a sorted set that can also go to the item at a given
+// position in the order, so that pages of a sorted listing can be read
+// without going through the items before them
+
+#ifndef ORDERTREE_HH
+#define ORDERTREE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Treap (a binary search tree balanced by random heap priorities) where each
+// node also stores the size of its subtree. Insert, erase and finding a
+// position are O(log n) on average. The nodes are kept in one vector and
+// refer to each other by index. Less must be a strict total order: items
+// that compare equivalent are the same item.
+template <typename Item, typename Less>
+class OrderTree
+{
+public:
+    explicit OrderTree(Less less = Less()) : less_(less) {}
+
+    std::size_t size() const { return size_of(root_); }
+
+    void clear()
+    {
+        nodes_.clear();
+        free_.clear();
+        root_ = NIL;
+    }
+
+    void insert(Item const& item)
+    {
+        auto node = new_node(item);
+        auto [smaller, larger] = split(root_, item, false);
+        root_ = merge(merge(smaller, node), larger);
+    }
+
+    // Returns false if the item was not in the tree
+    bool erase(Item const& item)
+    {
+        auto [smaller, rest] = split(root_, item, false);
+        auto [equal, larger] = split(rest, item, true);
+        root_ = merge(smaller, larger);
+        if (equal == NIL) { return false; }
+        free_.push_back(equal);
+        return true;
+    }
+
+    // Calls func(item) for at most limit items in order, starting from position offset
+    template <typename Func>
+    void for_range(std::size_t offset, std::size_t limit, Func func) const
+    {
+        // The stack holds the nodes after the current one in the order, whose
+        // left subtree the search went into
+        std::vector<Index> stack;
+        Index node = root_;
+        while (node != NIL)
+        {
+            auto left_size = size_of(nodes_[node].left);
+            if (offset < left_size)
+            {
+                stack.push_back(node);
+                node = nodes_[node].left;
+            }
+            else if (offset == left_size)
+            {
+                stack.push_back(node);
+                break;
+            }
+            else
+            {
+                offset -= left_size + 1;
+                node = nodes_[node].right;
+            }
+        }
+
+        for ( ; limit > 0 && !stack.empty(); --limit)
+        {
+            node = stack.back();
+            stack.pop_back();
+            func(nodes_[node].item);
+            for (node = nodes_[node].right; node != NIL; node = nodes_[node].left)
+            {
+                stack.push_back(node);
+            }
+        }
+    }
+
+    // Replaces the contents with items that are already sorted, in O(n)
+    void assign_sorted(std::vector<Item> const& items)
+    {
+        clear();
+        nodes_.reserve(items.size());
+        // Builds the Cartesian tree of the priorities: the stack holds the
+        // right spine of the tree built so far
+        std::vector<Index> spine;
+        for (auto const& item : items)
+        {
+            auto node = new_node(item);
+            Index last = NIL;
+            while (!spine.empty() && nodes_[spine.back()].priority < nodes_[node].priority)
+            {
+                last = spine.back();
+                spine.pop_back();
+            }
+            nodes_[node].left = last;
+            if (!spine.empty()) { nodes_[spine.back()].right = node; }
+            spine.push_back(node);
+        }
+        root_ = spine.empty() ? NIL : spine.front();
+        update_sizes(root_);
+    }
+
+private:
+    using Index = std::uint32_t;
+    static constexpr Index NIL = ~Index(0);
+
+    struct Node
+    {
+        Item item;
+        std::uint32_t priority;
+        Index size;
+        Index left;
+        Index right;
+    };
+
+    Index new_node(Item const& item)
+    {
+        Node node{item, next_priority(), 1, NIL, NIL};
+        if (free_.empty())
+        {
+            nodes_.push_back(std::move(node));
+            return static_cast<Index>(nodes_.size() - 1);
+        }
+        auto index = free_.back();
+        free_.pop_back();
+        nodes_[index] = std::move(node);
+        return index;
+    }
+
+    // Xorshift, so that the shape of the tree does not depend on the platform
+    std::uint32_t next_priority()
+    {
+        random_state_ ^= random_state_ << 13;
+        random_state_ ^= random_state_ >> 17;
+        random_state_ ^= random_state_ << 5;
+        return random_state_;
+    }
+
+    Index size_of(Index node) const { return (node == NIL) ? 0 : nodes_[node].size; }
+
+    void update_size(Index node)
+    {
+        nodes_[node].size = 1 + size_of(nodes_[node].left) + size_of(nodes_[node].right);
+    }
+
+    Index update_sizes(Index node)
+    {
+        if (node == NIL) { return 0; }
+        nodes_[node].size = 1 + update_sizes(nodes_[node].left) + update_sizes(nodes_[node].right);
+        return nodes_[node].size;
+    }
+
+    // Splits the tree into items before the item and the rest, or if
+    // inclusive, into items up to and including the item and the rest
+    std::pair<Index, Index> split(Index node, Item const& item, bool inclusive)
+    {
+        if (node == NIL) { return {NIL, NIL}; }
+        bool goes_left = inclusive ? !less_(item, nodes_[node].item) : less_(nodes_[node].item, item);
+        if (goes_left)
+        {
+            auto [smaller, larger] = split(nodes_[node].right, item, inclusive);
+            nodes_[node].right = smaller;
+            update_size(node);
+            return {node, larger};
+        }
+        auto [smaller, larger] = split(nodes_[node].left, item, inclusive);
+        nodes_[node].left = larger;
+        update_size(node);
+        return {smaller, node};
+    }
+
+    // Joins two trees where all items of the first are before the items of the second
+    Index merge(Index first, Index second)
+    {
+        if (first == NIL) { return second; }
+        if (second == NIL) { return first; }
+        if (nodes_[first].priority > nodes_[second].priority)
+        {
+            nodes_[first].right = merge(nodes_[first].right, second);
+            update_size(first);
+            return first;
+        }
+        nodes_[second].left = merge(first, nodes_[second].left);
+        update_size(second);
+        return second;
+    }
+
+    Less less_;
+    std::vector<Node> nodes_;
+    std::vector<Index> free_; // Nodes of erased items, reused by insert
+    Index root_ = NIL;
+    std::uint32_t random_state_ = 2463534242u;
+};
+
+#endif // ORDERTREE_HH
@@ -0,0 +1,567 @@
+// Perfstats.cc
+
+#include "perfstats.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <new>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Heap counting replaces the global allocation functions, so it is only
+// compiled in when asked for (HEAP_COUNTING, qmake CONFIG+=heapcount)
+#ifdef HEAP_COUNTING
+#if defined(__GLIBC__)
+#include <malloc.h>
+#define HEAP_COUNTING_SIZE(ptr) malloc_usable_size(ptr)
+#elif defined(_MSC_VER)
+#include <malloc.h>
+#define HEAP_COUNTING_SIZE(ptr) _msize(ptr)
+#endif
+#endif // HEAP_COUNTING
+
+void LatencyHistogram::add(double seconds)
+{
+    add_nanoseconds(seconds > 0 ? static_cast<std::uint64_t>(std::llround(seconds*1e9)) : 0);
+}
+
+void LatencyHistogram::add_nanoseconds(std::uint64_t ns)
+{
+    ++buckets_[bucket_index(ns)];
+    ++count_;
+    total_ns_ += ns;
+    max_ns_ = std::max(max_ns_, ns);
+}
+
+void LatencyHistogram::merge(LatencyHistogram const& other)
+{
+    for (int i = 0; i < BUCKET_COUNT; ++i)
+    {
+        buckets_[i] += other.buckets_[i];
+    }
+    count_ += other.count_;
+    total_ns_ += other.total_ns_;
+    max_ns_ = std::max(max_ns_, other.max_ns_);
+}
+
+void LatencyHistogram::clear()
+{
+    buckets_.fill(0);
+    count_ = 0;
+    total_ns_ = 0;
+    max_ns_ = 0;
+}
+
+double LatencyHistogram::total() const
+{
+    return total_ns_ / 1e9;
+}
+
+double LatencyHistogram::max() const
+{
+    return max_ns_ / 1e9;
+}
+
+double LatencyHistogram::percentile(double percent) const
+{
+    if (count_ == 0) { return 0; }
+
+    // Rank of the wanted operation (1-based), at least the first one
+    auto rank = static_cast<std::uint64_t>(std::ceil(percent / 100 * count_));
+    rank = std::clamp<std::uint64_t>(rank, 1, count_);
+
+    std::uint64_t seen = 0;
+    for (int i = 0; i < BUCKET_COUNT; ++i)
+    {
+        seen += buckets_[i];
+        if (seen >= rank)
+        {
+            return std::min(bucket_upper_limit(i), max_ns_) / 1e9;
+        }
+    }
+    return max();
+}
+
+int LatencyHistogram::bucket_index(std::uint64_t ns)
+{
+    if (ns < static_cast<std::uint64_t>(SUB_BUCKETS)) { return static_cast<int>(ns); }
+
+    // Position of the highest set bit decides the power of two, the next
+    // SUB_BUCKET_BITS bits decide the linear bucket inside it
+    int msb = 0;
+    while ((ns >> msb) > 1) { ++msb; }
+    int shift = msb - SUB_BUCKET_BITS;
+    auto sub = static_cast<int>(ns >> shift) - SUB_BUCKETS;
+    return (shift+1)*SUB_BUCKETS + sub;
+}
+
+std::uint64_t LatencyHistogram::bucket_upper_limit(int index)
+{
+    if (index < SUB_BUCKETS) { return static_cast<std::uint64_t>(index); }
+
+    int shift = index/SUB_BUCKETS - 1;
+    std::uint64_t sub = index%SUB_BUCKETS;
+    std::uint64_t lower = (SUB_BUCKETS + sub) << shift;
+    return lower + ((std::uint64_t(1) << shift) - 1);
+}
+
+void write_perftest_json(std::ostream& output, PerftestResult const& result)
+{
+    auto oldprecision = output.precision(9);
+
+    output << "{\n";
+    output << "  \"command_set\": \"" << result.command_set << "\",\n";
+    output << "  \"timeout\": " << result.timeout << ",\n";
+    output << "  \"repeat_count\": " << result.repeat_count << ",\n";
+    output << "  \"seed\": " << result.seed << ",\n";
+    output << "  \"sizes\": [";
+    for (unsigned int i = 0; i < result.sizes.size(); ++i)
+    {
+        output << (i > 0 ? ", " : "") << result.sizes[i];
+    }
+    output << "],\n";
+    output << "  \"complete\": " << (result.complete ? "true" : "false") << ",\n";
+    output << "  \"rounds\": [";
+    for (unsigned int r = 0; r < result.rounds.size(); ++r)
+    {
+        auto& round = result.rounds[r];
+        output << (r > 0 ? "," : "") << "\n    {\"n\": " << round.n << ", \"add_sec\": " << round.add_sec
+               << ", \"cmds_sec\": " << round.cmds_sec << ", \"total_sec\": " << round.total_sec
+               << ", \"heap_bytes\": " << round.heap_bytes << ", \"peak_heap_bytes\": " << round.peak_heap_bytes
+               << ", \"peak_rss_kb\": " << round.peak_rss_kb << ",";
+        if (!round.counters.empty())
+        {
+            output << "\n     \"counters_per_op\": {";
+            for (unsigned int c = 0; c < round.counters.size(); ++c)
+            {
+                output << (c > 0 ? ", " : "") << "\"" << round.counters[c].first << "\": " << round.counters[c].second;
+            }
+            output << "},";
+        }
+        output << "\n     \"commands\": [";
+        for (unsigned int c = 0; c < round.cmds.size(); ++c)
+        {
+            auto& cmd = round.cmds[c];
+            output << (c > 0 ? "," : "") << "\n       {\"cmd\": \"" << cmd.cmd << "\", \"count\": " << cmd.count
+                   << ", \"p50_sec\": " << cmd.p50_sec << ", \"p90_sec\": " << cmd.p90_sec
+                   << ", \"p99_sec\": " << cmd.p99_sec << ", \"max_sec\": " << cmd.max_sec
+                   << ", \"mean_sec\": " << cmd.mean_sec << "}";
+        }
+        output << "]}";
+    }
+    output << "\n  ]\n}\n";
+
+    output.precision(oldprecision);
+}
+
+void write_perftest_csv(std::ostream& output, PerftestResult const& result)
+{
+    auto oldprecision = output.precision(9);
+
+    output << "command_set,n,add_sec,cmds_sec,total_sec,heap_bytes,peak_heap_bytes,peak_rss_kb,cmd,count,p50_sec,p90_sec,p99_sec,max_sec,mean_sec\n";
+    for (auto& round : result.rounds)
+    {
+        for (auto& cmd : round.cmds)
+        {
+            output << result.command_set << ',' << round.n << ',' << round.add_sec << ',' << round.cmds_sec << ','
+                   << round.total_sec << ',' << round.heap_bytes << ',' << round.peak_heap_bytes << ',' << round.peak_rss_kb << ','
+                   << cmd.cmd << ',' << cmd.count << ',' << cmd.p50_sec << ',' << cmd.p90_sec << ','
+                   << cmd.p99_sec << ',' << cmd.max_sec << ',' << cmd.mean_sec << '\n';
+        }
+    }
+
+    output.precision(oldprecision);
+}
+
+namespace
+{
+std::string const json_num = "(-?[0-9]+(?:\\.[0-9]+)?(?:[eE][-+]?[0-9]+)?)";
+
+std::string json_field(std::string const& json, std::string const& name, std::string const& valuex)
+{
+    std::smatch match;
+    if (!std::regex_search(json, match, std::regex("\"" + name + "\"[[:space:]]*:[[:space:]]*" + valuex)))
+    {
+        throw std::invalid_argument("Field '" + name + "' missing from perftest results");
+    }
+    return match[1];
+}
+}
+
+PerftestResult read_perftest_json(std::istream& input)
+{
+    std::string json(std::istreambuf_iterator<char>(input), {});
+    PerftestResult result;
+
+    // Everything before the rounds belongs to the run itself
+    auto roundspos = json.find("\"rounds\"");
+    if (roundspos == std::string::npos)
+    {
+        throw std::invalid_argument("Field 'rounds' missing from perftest results");
+    }
+    std::string header = json.substr(0, roundspos);
+    result.command_set = json_field(header, "command_set", "\"([0-9a-zA-Z_;]+)\"");
+    result.timeout = std::stoul(json_field(header, "timeout", json_num));
+    result.repeat_count = std::stoul(json_field(header, "repeat_count", json_num));
+    result.seed = std::stoul(json_field(header, "seed", json_num));
+    result.complete = json_field(header, "complete", "(true|false)") == "true";
+    std::istringstream sizes(json_field(header, "sizes", "\\[([0-9, ]*)\\]"));
+    for (std::string size; std::getline(sizes, size, ','); )
+    {
+        result.sizes.push_back(std::stoul(size));
+    }
+
+    std::regex roundx("\\{\"n\": ([0-9]+), \"add_sec\": "+json_num+", \"cmds_sec\": "+json_num+", \"total_sec\": "+json_num+
+                      ", \"heap_bytes\": "+json_num+", \"peak_heap_bytes\": "+json_num+", \"peak_rss_kb\": "+json_num);
+    std::regex cmdx("\\{\"cmd\": \"([0-9a-zA-Z_]+)\", \"count\": ([0-9]+), \"p50_sec\": "+json_num+", \"p90_sec\": "+json_num+
+                    ", \"p99_sec\": "+json_num+", \"max_sec\": "+json_num+"(?:, \"mean_sec\": "+json_num+")?\\}");
+    std::string rounds = json.substr(roundspos);
+    for (std::sregex_iterator iter(rounds.begin(), rounds.end(), roundx), end; iter != end; ++iter)
+    {
+        auto& match = *iter;
+        PerftestRound round;
+        round.n = std::stoul(match[1]);
+        round.add_sec = std::stod(match[2]);
+        round.cmds_sec = std::stod(match[3]);
+        round.total_sec = std::stod(match[4]);
+        round.heap_bytes = std::stoll(match[5]);
+        round.peak_heap_bytes = std::stoll(match[6]);
+        round.peak_rss_kb = std::stoul(match[7]);
+
+        // Commands of this round are between the end of this match and the closing ]
+        auto cmdsbegin = match.suffix().first;
+        auto cmdsend = std::find(cmdsbegin, rounds.cend(), ']');
+        for (std::sregex_iterator citer(cmdsbegin, cmdsend, cmdx); citer != end; ++citer)
+        {
+            auto& cmatch = *citer;
+            round.cmds.push_back({cmatch[1], std::stoull(cmatch[2]), std::stod(cmatch[3]), std::stod(cmatch[4]),
+                                  std::stod(cmatch[5]), std::stod(cmatch[6]), cmatch[7].matched ? std::stod(cmatch[7]) : 0});
+        }
+        result.rounds.push_back(std::move(round));
+    }
+
+    return result;
+}
+
+std::string complexity_to_string(Complexity complexity)
+{
+    switch (complexity)
+    {
+    case Complexity::CONSTANT:
+        return "O(1)";
+    case Complexity::LOGARITHMIC:
+        return "O(log n)";
+    case Complexity::LINEAR:
+        return "O(n)";
+    case Complexity::LINEARITHMIC:
+        return "O(n log n)";
+    case Complexity::QUADRATIC:
+        return "O(n^2)";
+    default:
+        return "?";
+    }
+}
+
+Complexity complexity_from_string(std::string const& str)
+{
+    for (auto complexity : {Complexity::CONSTANT, Complexity::LOGARITHMIC, Complexity::LINEAR,
+                            Complexity::LINEARITHMIC, Complexity::QUADRATIC})
+    {
+        if (complexity_to_string(complexity) == str) { return complexity; }
+    }
+    return Complexity::UNKNOWN;
+}
+
+namespace
+{
+double complexity_function(Complexity complexity, double n)
+{
+    n = std::max(n, 2.0); // Keep log n positive
+    switch (complexity)
+    {
+    case Complexity::CONSTANT:
+        return 1;
+    case Complexity::LOGARITHMIC:
+        return std::log2(n);
+    case Complexity::LINEAR:
+        return n;
+    case Complexity::LINEARITHMIC:
+        return n*std::log2(n);
+    case Complexity::QUADRATIC:
+        return n*n;
+    default:
+        return 0;
+    }
+}
+
+// Root mean square of relative errors when fitting time = c*f(n)
+double fit_error(std::vector<std::pair<double, double>> const& series, Complexity complexity)
+{
+    // Least squares of relative errors, i.e. minimize sum(((c*f - t)/t)^2)
+    double sum_f = 0;
+    double sum_ff = 0;
+    for (auto& [n, time] : series)
+    {
+        double f = complexity_function(complexity, n) / time;
+        sum_f += f;
+        sum_ff += f*f;
+    }
+    double c = sum_f / sum_ff;
+
+    double error = 0;
+    for (auto& [n, time] : series)
+    {
+        double relative = (c*complexity_function(complexity, n) - time) / time;
+        error += relative*relative;
+    }
+    return std::sqrt(error / series.size());
+}
+}
+
+Complexity fit_complexity(std::vector<std::pair<double, double>> const& series)
+{
+    // A more complex class has to reduce the error by this factor to be chosen
+    double const improvement_needed = 0.8;
+    // Only N's at most this many times smaller than the largest one are used
+    double const fit_range = 100;
+
+    double max_n = 0;
+    for (auto& point : series)
+    {
+        if (point.second <= 0) { return Complexity::UNKNOWN; }
+        max_n = std::max(max_n, point.first);
+    }
+
+    std::vector<std::pair<double, double>> fitted;
+    std::copy_if(series.begin(), series.end(), std::back_inserter(fitted),
+                 [max_n, fit_range](auto const& point){ return point.first*fit_range >= max_n; });
+    if (fitted.size() < 3) { return Complexity::UNKNOWN; }
+
+    Complexity best = Complexity::UNKNOWN;
+    double best_error = 0;
+    for (auto complexity : {Complexity::CONSTANT, Complexity::LOGARITHMIC, Complexity::LINEAR,
+                            Complexity::LINEARITHMIC, Complexity::QUADRATIC})
+    {
+        double error = fit_error(fitted, complexity);
+        if (best == Complexity::UNKNOWN || error < improvement_needed*best_error)
+        {
+            best = complexity;
+            best_error = error;
+        }
+    }
+    return best;
+}
+
+#ifdef __linux__
+
+PerfCounters::PerfCounters()
+{
+    fds_.fill(-1);
+
+    std::array<std::pair<std::uint32_t, std::uint64_t>, COUNTER_COUNT> const events =
+    {{
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    }};
+
+    for (int i = 0; i < COUNTER_COUNT; ++i)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].first;
+        attr.config = events[i].second;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1; // Allowed without privileges (perf_event_paranoid <= 2)
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        fds_[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        if (fds_[i] < 0 && error_.empty())
+        {
+            error_ = name(static_cast<Counter>(i)) + ": " + std::strerror(errno);
+        }
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+    for (auto fd : fds_)
+    {
+        if (fd >= 0) { close(fd); }
+    }
+}
+
+void PerfCounters::start()
+{
+    for (auto fd : fds_)
+    {
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+void PerfCounters::stop()
+{
+    for (auto fd : fds_)
+    {
+        if (fd >= 0) { ioctl(fd, PERF_EVENT_IOC_DISABLE, 0); }
+    }
+}
+
+double PerfCounters::value(Counter counter) const
+{
+    if (!available(counter)) { return -1; }
+
+    std::uint64_t data[3] = {}; // value, time enabled, time running
+    if (read(fds_[counter], data, sizeof(data)) != sizeof(data)) { return -1; }
+    if (data[2] == 0) { return 0; } // Never scheduled on the PMU
+
+    return static_cast<double>(data[0]) * data[1] / data[2];
+}
+
+#else
+
+PerfCounters::PerfCounters()
+{
+    fds_.fill(-1);
+    error_ = "only supported on Linux";
+}
+
+PerfCounters::~PerfCounters() {}
+void PerfCounters::start() {}
+void PerfCounters::stop() {}
+double PerfCounters::value(Counter /*counter*/) const { return -1; }
+
+#endif // __linux__
+
+bool PerfCounters::available() const
+{
+    return std::any_of(fds_.begin(), fds_.end(), [](int fd){ return fd >= 0; });
+}
+
+bool PerfCounters::available(Counter counter) const
+{
+    return fds_[counter] >= 0;
+}
+
+std::string PerfCounters::name(Counter counter)
+{
+    switch (counter)
+    {
+    case CYCLES:
+        return "cycles";
+    case INSTRUCTIONS:
+        return "instructions";
+    case L1D_MISSES:
+        return "L1D_misses";
+    case LLC_MISSES:
+        return "LLC_misses";
+    case BRANCH_MISSES:
+        return "branch_misses";
+    default:
+        return "?";
+    }
+}
+
+std::pair<unsigned long int, std::string> mempeak()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmHWM:") == 0)
+        {
+            std::istringstream istr(line.substr(6));
+            unsigned long int value = 0;
+            std::string unit;
+            if (istr >> value >> unit)
+            {
+                return {value, unit};
+            }
+        }
+    }
+    return {0, ""};
+}
+
+bool reset_mempeak()
+{
+    // Writing 5 to clear_refs resets the peak RSS (Linux 4.0 and later)
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    if (!clear_refs) { return false; }
+    clear_refs << "5" << std::flush;
+    return static_cast<bool>(clear_refs);
+}
+
+#ifdef HEAP_COUNTING_SIZE
+
+namespace
+{
+std::atomic<std::size_t> heap_live{0};
+std::atomic<std::size_t> heap_peak{0};
+
+void count_allocation(void* ptr)
+{
+    auto live = heap_live.fetch_add(HEAP_COUNTING_SIZE(ptr), std::memory_order_relaxed) + HEAP_COUNTING_SIZE(ptr);
+    auto peak = heap_peak.load(std::memory_order_relaxed);
+    while (live > peak && !heap_peak.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+}
+}
+
+// Replacements of the global allocation functions, which count the bytes
+// allocated from the heap. The array and nothrow versions of the standard
+// library call these, so replacing these two (and sized delete) is enough.
+void* operator new(std::size_t size)
+{
+    void* ptr = std::malloc(size ? size : 1);
+    if (!ptr) { throw std::bad_alloc(); }
+    count_allocation(ptr);
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (!ptr) { return; }
+    heap_live.fetch_sub(HEAP_COUNTING_SIZE(ptr), std::memory_order_relaxed);
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t /*size*/) noexcept
+{
+    operator delete(ptr);
+}
+
+bool heap_counting_enabled() { return true; }
+std::size_t heap_live_bytes() { return heap_live.load(std::memory_order_relaxed); }
+std::size_t heap_peak_bytes() { return heap_peak.load(std::memory_order_relaxed); }
+void reset_heap_peak() { heap_peak.store(heap_live.load(std::memory_order_relaxed), std::memory_order_relaxed); }
+
+#else
+
+bool heap_counting_enabled() { return false; }
+std::size_t heap_live_bytes() { return 0; }
+std::size_t heap_peak_bytes() { return 0; }
+void reset_heap_peak() {}
+
+#endif // HEAP_COUNTING_SIZE
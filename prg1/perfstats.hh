@@ -0,0 +1,159 @@
+// Perfstats.hh
+//
+// Helpers for collecting statistics in perftest
+
+#ifndef PERFSTATS_HH
+#define PERFSTATS_HH
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+#include <iosfwd>
+
+// Log-linear histogram of operation latencies. Latencies are stored in
+// nanoseconds, grouped by powers of two, and each power of two is split into
+// SUB_BUCKETS linear buckets. This keeps the histogram small and fixed-size
+// while the relative error of any reported percentile stays below 1/SUB_BUCKETS.
+class LatencyHistogram
+{
+public:
+    static int const SUB_BUCKET_BITS = 4;
+    static int const SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+
+    void add(double seconds);
+    void add_nanoseconds(std::uint64_t ns);
+    void merge(LatencyHistogram const& other);
+    void clear();
+
+    std::uint64_t count() const { return count_; }
+    double total() const; // In seconds
+    double max() const; // In seconds
+
+    // Returns the latency (in seconds) below which the given percentage
+    // (0-100) of the recorded operations fall, rounded up to the bucket limit
+    double percentile(double percent) const;
+
+private:
+    static int const BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+    static int bucket_index(std::uint64_t ns);
+    static std::uint64_t bucket_upper_limit(int index);
+
+    std::array<std::uint64_t, BUCKET_COUNT> buckets_ = {};
+    std::uint64_t count_ = 0;
+    std::uint64_t total_ns_ = 0;
+    std::uint64_t max_ns_ = 0;
+};
+
+// Results of one perftest run. Only the N's that were run to completion
+// (no timeout or stop) are included in rounds.
+struct PerftestCmdStats
+{
+    std::string cmd;
+    std::uint64_t count = 0;
+    double p50_sec = 0;
+    double p90_sec = 0;
+    double p99_sec = 0;
+    double max_sec = 0;
+    double mean_sec = 0;
+};
+
+struct PerftestRound
+{
+    unsigned int n = 0;
+    double add_sec = 0;
+    double cmds_sec = 0;
+    double total_sec = 0;
+    long long int heap_bytes = 0; // Relative to the start of the round
+    long long int peak_heap_bytes = 0;
+    unsigned long int peak_rss_kb = 0;
+    std::vector<PerftestCmdStats> cmds;
+    // Hardware counter values per operation, if counters were enabled
+    std::vector<std::pair<std::string, double>> counters;
+};
+
+struct PerftestResult
+{
+    std::string command_set;
+    unsigned int timeout = 0;
+    unsigned int repeat_count = 0;
+    unsigned long int seed = 0; // Random seed the run was started with (0 = not recorded)
+    std::vector<unsigned int> sizes;
+    bool complete = true;
+    std::vector<PerftestRound> rounds;
+};
+
+// Machine-readable output of perftest results. CSV has one row per command
+// and N, with the totals of the N repeated on each row.
+void write_perftest_json(std::ostream& output, PerftestResult const& result);
+void write_perftest_csv(std::ostream& output, PerftestResult const& result);
+
+// Reads results written by write_perftest_json. Throws std::invalid_argument
+// if the input does not look like perftest results.
+PerftestResult read_perftest_json(std::istream& input);
+
+// Complexity classes that perftest timing series are fitted to
+enum class Complexity { CONSTANT, LOGARITHMIC, LINEAR, LINEARITHMIC, QUADRATIC, UNKNOWN };
+
+std::string complexity_to_string(Complexity complexity); // E.g. "O(n log n)"
+Complexity complexity_from_string(std::string const& str); // UNKNOWN if not recognized
+
+// Finds the complexity class f that best explains the series of (n, time)
+// pairs as time = c*f(n). Only the two largest decades of N are used, because
+// constant overheads dominate with small N. The fit is done by least squares
+// on relative errors, so that all N's weigh the same. If a more complex class
+// is only marginally better than a simpler one, the simpler one is chosen.
+// Returns UNKNOWN if there are less than 3 points to fit.
+Complexity fit_complexity(std::vector<std::pair<double, double>> const& series);
+
+// Hardware performance counters of the calling thread, read with Linux
+// perf_event_open. Counters that cannot be opened (no permission, not
+// supported by the CPU or a virtual machine, other OS) are unavailable and
+// read as a negative value. If the kernel multiplexes counters, the values
+// are scaled to the whole measured time.
+class PerfCounters
+{
+public:
+    enum Counter { CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES, COUNTER_COUNT };
+
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(PerfCounters const&) = delete;
+    PerfCounters& operator=(PerfCounters const&) = delete;
+
+    bool available() const; // True if at least one counter is available
+    bool available(Counter counter) const;
+    std::string const& error() const { return error_; } // Reason why counters are not available
+
+    void start(); // Resets and enables all counters
+    void stop();
+    double value(Counter counter) const;
+
+    static std::string name(Counter counter);
+
+private:
+    std::array<int, COUNTER_COUNT> fds_;
+    std::string error_;
+};
+
+// Peak resident set size of the process ("VmHWM" in /proc/self/status) and
+// its unit, or {0, ""} if it cannot be read (e.g. on other OSes than Linux)
+std::pair<unsigned long int, std::string> mempeak();
+
+// Resets the peak resident set size reported by mempeak() to the current
+// resident set size (Linux only). Returns false if resetting is not possible.
+bool reset_mempeak();
+
+// Heap usage as counted by the replaced global operator new/delete. The
+// counting is only compiled in with HEAP_COUNTING defined (qmake
+// CONFIG+=heapcount). Without it, or if it is not available on the platform,
+// heap_counting_enabled() returns false and the byte counts are always 0.
+bool heap_counting_enabled();
+std::size_t heap_live_bytes();
+std::size_t heap_peak_bytes();
+void reset_heap_peak(); // Sets peak to the current live byte count
+
+#endif // PERFSTATS_HH
@@ -0,0 +1,5 @@
+# Non-graphical command line version of prg1, which can be built without Qt
+# libraries (qmake is still needed). Same as "qmake prg1.pro CONFIG+=headless".
+
+CONFIG += headless
+include(prg1.pro)
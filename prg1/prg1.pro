@@ -10,13 +10,39 @@
 # "Rebuild all" from the Build menu
 #QMAKE_CXXFLAGS += -D_GLIBCXX_DEBUG -D_GLIBCXX_DEBUG_PEDANTIC
 
-QT       += core gui
+# Run qmake with "CONFIG+=headless" (or use prg1-console.pro) to build the
+# non-graphical command line version, which does not need Qt at runtime
+# (e.g. for running performance tests on a server).
 
-CONFIG += c++17 warn_on
+# Run qmake with "CONFIG+=stats" to collect per-operation call counts and
+# times inside Datastructures (shown and reset by the "stats" command).
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+# Run qmake with "CONFIG+=heapcount" to count the heap usage of perftest
+# rounds. This replaces the global operator new and delete, which adds a
+# little work to every allocation, so it is not on by default.
+
+CONFIG += c++17 warn_on thread
+
+stats {
+    DEFINES += DATASTRUCTURES_STATS
+}
+
+heapcount {
+    DEFINES += HEAP_COUNTING
+}
+
+headless {
+    CONFIG -= qt
+    CONFIG += console
+    CONFIG -= app_bundle
+    TARGET = prg1-console
+} else {
+    QT       += core gui
+    greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+    DEFINES += GRAPHICAL_GUI
+    TARGET = prg1
+}
 
-TARGET = prg1
 TEMPLATE = app
 
 # The following define makes your compiler emit warnings if you use
@@ -34,20 +60,24 @@ DEFINES += QT_DEPRECATED_WARNINGS
 SOURCES += \
     datastructures.cc \
     mainwindow.cc \
-    mainprogram.cc
+    mainprogram.cc \
+    perfstats.cc \
+    trace.cc \
+    wal.cc \
+    changefeed.cc
 
 HEADERS += \
     datastructures.hh \
     mainwindow.hh \
-    mainprogram.hh
-
-FORMS += \
-    mainwindow.ui
-
+    mainprogram.hh \
+    perfstats.hh \
+    trace.hh \
+    wal.hh \
+    changefeed.hh \
+    ordertree.hh \
+    listview.hh
 
-# If you uncomment the lines below and recompile EVERYTHING (by selecting "Rebuild all" from the Build menu),
-# you'll get a non-graphical command line version of the program (just like if you had compiled the program
-# directly using the g++ command.
-#FORMS -= mainprogram.ui
-#CONFIG -= core gui qt
-#CONFIG += console
+!headless {
+    FORMS += \
+        mainwindow.ui
+}
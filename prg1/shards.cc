@@ -0,0 +1,298 @@
+// Shards.cc
+
+#include "shards.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <queue>
+
+namespace
+{
+
+// Merges lists sorted by key into one sorted list of ids. The lists are
+// pairs {key, id}. Equal keys are taken from the lists in list order.
+template <typename Key, typename Less>
+std::vector<PlaceID> merge_sorted(std::vector<std::vector<std::pair<Key, PlaceID>>> const& lists, Less less)
+{
+    // Heap of {list, position} of the next item of each list that has one
+    using Next = std::pair<std::size_t, std::size_t>;
+    auto after = [&lists, &less](Next const& next1, Next const& next2)
+    {
+        auto const& key1 = lists[next1.first][next1.second].first;
+        auto const& key2 = lists[next2.first][next2.second].first;
+        if (less(key2, key1)) { return true; }
+        if (less(key1, key2)) { return false; }
+        return next1.first > next2.first;
+    };
+    std::priority_queue<Next, std::vector<Next>, decltype(after)> heap(after);
+
+    std::size_t total = 0;
+    for (std::size_t list = 0; list < lists.size(); ++list)
+    {
+        total += lists[list].size();
+        if (!lists[list].empty()) { heap.push({list, 0}); }
+    }
+
+    std::vector<PlaceID> result;
+    result.reserve(total);
+    while (!heap.empty())
+    {
+        auto [list, position] = heap.top();
+        heap.pop();
+        result.push_back(lists[list][position].second);
+        if (++position < lists[list].size()) { heap.push({list, position}); }
+    }
+    return result;
+}
+
+} // namespace
+
+ShardedDatastructures::ShardedDatastructures(unsigned int shard_count)
+{
+    shard_count = std::max(1u, shard_count);
+    for (unsigned int i = 0; i < shard_count; ++i)
+    {
+        shards_.push_back(std::make_unique<Shard>());
+        shards_.back()->thread = std::thread(&ShardedDatastructures::run_shard, std::ref(*shards_.back()));
+    }
+}
+
+ShardedDatastructures::~ShardedDatastructures()
+{
+    for (auto& shard : shards_)
+    {
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->stopping = true;
+        }
+        shard->wakeup.notify_one();
+        shard->thread.join();
+    }
+}
+
+bool ShardedDatastructures::add_place(PlaceID id, Name const& name, PlaceType type, Coord xy)
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    return run(*shards_[shard_index(id)], [&](Datastructures& ds) { return ds.add_place(id, name, type, xy); }).get();
+}
+
+std::pair<Name, PlaceType> ShardedDatastructures::get_place_name_type(PlaceID id)
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    return run(*shards_[shard_index(id)], [id](Datastructures& ds) { return ds.get_place_name_type(id); }).get();
+}
+
+Coord ShardedDatastructures::get_place_coord(PlaceID id)
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    return run(*shards_[shard_index(id)], [id](Datastructures& ds) { return ds.get_place_coord(id); }).get();
+}
+
+bool ShardedDatastructures::change_place_name(PlaceID id, Name const& newname)
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    return run(*shards_[shard_index(id)], [&](Datastructures& ds) { return ds.change_place_name(id, newname); }).get();
+}
+
+bool ShardedDatastructures::change_place_coord(PlaceID id, Coord newcoord)
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    return run(*shards_[shard_index(id)], [id, newcoord](Datastructures& ds) { return ds.change_place_coord(id, newcoord); }).get();
+}
+
+bool ShardedDatastructures::remove_place(PlaceID id)
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    return run(*shards_[shard_index(id)], [id](Datastructures& ds) { return ds.remove_place(id); }).get();
+}
+
+int ShardedDatastructures::place_count()
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    auto counts = run_all([](Datastructures& ds) { return ds.place_count(); });
+    int total = 0;
+    for (auto count : counts) { total += count; }
+    return total;
+}
+
+void ShardedDatastructures::clear_all()
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    std::vector<std::future<void>> futures;
+    for (auto& shard : shards_) { futures.push_back(run(*shard, [](Datastructures& ds) { ds.clear_all(); })); }
+    for (auto& future : futures) { future.get(); }
+}
+
+void ShardedDatastructures::creation_finished()
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    std::vector<std::future<void>> futures;
+    for (auto& shard : shards_) { futures.push_back(run(*shard, [](Datastructures& ds) { ds.creation_finished(); })); }
+    for (auto& future : futures) { future.get(); }
+}
+
+std::vector<PlaceID> ShardedDatastructures::all_places()
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    auto lists = run_all([](Datastructures& ds) { return ds.all_places(); });
+    std::vector<PlaceID> result;
+    for (auto const& list : lists) { result.insert(result.end(), list.begin(), list.end()); }
+    return result;
+}
+
+std::vector<PlaceID> ShardedDatastructures::find_places_name(Name const& name)
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    auto lists = run_all([&name](Datastructures& ds) { return ds.find_places_name(name); });
+    std::vector<PlaceID> result;
+    for (auto const& list : lists) { result.insert(result.end(), list.begin(), list.end()); }
+    return result;
+}
+
+std::vector<PlaceID> ShardedDatastructures::find_places_type(PlaceType type)
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    auto lists = run_all([type](Datastructures& ds) { return ds.find_places_type(type); });
+    std::vector<PlaceID> result;
+    for (auto const& list : lists) { result.insert(result.end(), list.begin(), list.end()); }
+    return result;
+}
+
+std::vector<PlaceID> ShardedDatastructures::places_alphabetically()
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    return merged_order(name_order_, [this]()
+    {
+        // The shards also look up the names, so that the merge does not have to ask for them
+        auto lists = run_all([](Datastructures& ds)
+        {
+            std::vector<std::pair<Name, PlaceID>> places;
+            for (auto id : ds.places_alphabetically_view()) { places.push_back({ds.get_place_name_type(id).first, id}); }
+            return places;
+        });
+        return merge_sorted(lists, [](Name const& name1, Name const& name2) { return name1 < name2; });
+    });
+}
+
+std::vector<PlaceID> ShardedDatastructures::places_coord_order()
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    return merged_order(coord_order_, [this]()
+    {
+        auto lists = run_all([](Datastructures& ds)
+        {
+            std::vector<std::pair<Coord, PlaceID>> places;
+            for (auto id : ds.places_coord_order_view()) { places.push_back({ds.get_place_coord(id), id}); }
+            return places;
+        });
+        return merge_sorted(lists, [](Coord xy1, Coord xy2) { return xy1 < xy2; });
+    });
+}
+
+std::vector<PlaceID> ShardedDatastructures::places_closest_to(Coord xy, PlaceType type)
+{
+    std::shared_lock<std::shared_mutex> lock(batch_mutex_);
+    auto lists = run_all([xy, type](Datastructures& ds)
+    {
+        std::vector<std::pair<Coord, PlaceID>> places;
+        for (auto id : ds.places_closest_to(xy, type)) { places.push_back({ds.get_place_coord(id), id}); }
+        return places;
+    });
+
+    // Same order as in Datastructures: distance, then y coordinate
+    std::vector<std::pair<Coord, PlaceID>> candidates;
+    for (auto const& list : lists) { candidates.insert(candidates.end(), list.begin(), list.end()); }
+    std::stable_sort(candidates.begin(), candidates.end(), [xy](auto const& place1, auto const& place2)
+    {
+        auto distance1 = calculate_eucledean({place1.first.x - xy.x, place1.first.y - xy.y});
+        auto distance2 = calculate_eucledean({place2.first.x - xy.x, place2.first.y - xy.y});
+        return distance1 < distance2 || (distance1 == distance2 && place1.first.y < place2.first.y);
+    });
+
+    std::vector<PlaceID> result;
+    for (std::size_t i = 0; i < candidates.size() && i < 3; ++i) { result.push_back(candidates[i].second); }
+    return result;
+}
+
+std::size_t ShardedDatastructures::apply_batch(std::vector<Mutation> const& mutations)
+{
+    std::unique_lock<std::shared_mutex> lock(batch_mutex_);
+
+    // Mutations of each shard, and their indexes in mutations
+    std::vector<std::vector<Mutation>> shard_mutations(shards_.size());
+    std::vector<std::vector<std::size_t>> shard_indexes(shards_.size());
+    for (std::size_t i = 0; i < mutations.size(); ++i)
+    {
+        auto shard = shard_index(mutations[i].id);
+        shard_mutations[shard].push_back(mutations[i]);
+        shard_indexes[shard].push_back(i);
+    }
+
+    std::vector<std::future<std::size_t>> futures;
+    for (std::size_t shard = 0; shard < shards_.size(); ++shard)
+    {
+        auto const& batch = shard_mutations[shard];
+        futures.push_back(run(*shards_[shard], [&batch](Datastructures& ds) { return ds.check_batch(batch); }));
+    }
+    std::size_t first_invalid = mutations.size();
+    for (std::size_t shard = 0; shard < shards_.size(); ++shard)
+    {
+        auto invalid = futures[shard].get();
+        if (invalid < shard_indexes[shard].size())
+        {
+            first_invalid = std::min(first_invalid, shard_indexes[shard][invalid]);
+        }
+    }
+    if (first_invalid < mutations.size()) { return first_invalid; }
+
+    futures.clear();
+    for (std::size_t shard = 0; shard < shards_.size(); ++shard)
+    {
+        auto const& batch = shard_mutations[shard];
+        if (batch.empty()) { continue; }
+        futures.push_back(run(*shards_[shard], [&batch](Datastructures& ds) { return ds.apply_batch(batch); }));
+    }
+    for (auto& future : futures) { future.get(); }
+    return mutations.size();
+}
+
+template <typename Func>
+std::vector<PlaceID> ShardedDatastructures::merged_order(MergedOrder& order, Func merge)
+{
+    auto generations = run_all([](Datastructures& ds) { return ds.generation(); });
+    {
+        std::lock_guard<std::mutex> lock(order_mutex_);
+        if (order.generations == generations) { return order.places; }
+    }
+
+    // The shards may have changed again after reading their generations. The
+    // order is then saved with generations older than its data, so it is
+    // merged again on the next call, but never used when it is out of date.
+    auto places = merge();
+    std::lock_guard<std::mutex> lock(order_mutex_);
+    order = {std::move(generations), places};
+    return places;
+}
+
+std::size_t ShardedDatastructures::shard_index(PlaceID id) const
+{
+    // Fibonacci hashing, so that ids with a common stride are spread evenly
+    auto hash = static_cast<std::uint64_t>(id) * 0x9e3779b97f4a7c15u;
+    return (hash >> 32) % shards_.size();
+}
+
+void ShardedDatastructures::run_shard(Shard& shard)
+{
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    while (true)
+    {
+        shard.wakeup.wait(lock, [&shard]() { return shard.stopping || !shard.tasks.empty(); });
+        if (shard.tasks.empty()) { return; } // Stopping, and every task has been run
+
+        auto task = std::move(shard.tasks.front());
+        shard.tasks.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
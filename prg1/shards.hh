@@ -0,0 +1,139 @@
+// Shards.hh
+//
+// Places divided between several Datastructures, each run by its own thread,
+// so that changes and queries can use more than one core
+
+#ifndef SHARDS_HH
+#define SHARDS_HH
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "datastructures.hh"
+
+// Facade for the place operations of Datastructures. Each place belongs to
+// the shard given by a hash of its id. Operations on one place are run by
+// the thread of its shard, while queries over all places are run by all the
+// shards in parallel, and their results merged. Areas are not sharded: they
+// are not part of the facade.
+//
+// The functions can be called from several threads at once. Operations on
+// places in different shards then run in parallel, and operations on the same
+// shard are run one at a time in the order they arrive. apply_batch runs
+// alone, so that no other change gets in between checking and applying it.
+class ShardedDatastructures
+{
+public:
+    explicit ShardedDatastructures(unsigned int shard_count = std::thread::hardware_concurrency());
+    ~ShardedDatastructures();
+
+    ShardedDatastructures(ShardedDatastructures const&) = delete;
+    ShardedDatastructures& operator=(ShardedDatastructures const&) = delete;
+
+    unsigned int shard_count() const { return static_cast<unsigned int>(shards_.size()); }
+
+    // Operations on one place, see Datastructures. Each is run by one shard,
+    // so their performance is that of Datastructures with n/shards places,
+    // plus passing the call to the shard thread and back.
+    bool add_place(PlaceID id, Name const& name, PlaceType type, Coord xy);
+    std::pair<Name, PlaceType> get_place_name_type(PlaceID id);
+    Coord get_place_coord(PlaceID id);
+    bool change_place_name(PlaceID id, Name const& newname);
+    bool change_place_coord(PlaceID id, Coord newcoord);
+    bool remove_place(PlaceID id);
+
+    // Operations on all places, run by all shards in parallel. The results
+    // of the shards are concatenated in shard order.
+    int place_count();
+    void clear_all();
+    void creation_finished();
+    std::vector<PlaceID> all_places();
+    std::vector<PlaceID> find_places_name(Name const& name);
+    std::vector<PlaceID> find_places_type(PlaceType type);
+
+    // Sorted listings. Estimate of performance: O(s + n), O((n/s) log(n/s) + n log s)
+    // after changes, s = number of shards. Short rationale for estimate: the merged
+    // order is cached until the generation of a shard changes. Then the shards sort
+    // their places in parallel (or use their cached order), and the sorted lists
+    // are merged with a heap holding the next place of each shard.
+    std::vector<PlaceID> places_alphabetically();
+    std::vector<PlaceID> places_coord_order();
+
+    // Estimate of performance: O(n/s + s). Short rationale for estimate: each
+    // shard finds its closest 3 places, and the closest 3 of those are taken.
+    std::vector<PlaceID> places_closest_to(Coord xy, PlaceType type);
+
+    // Same result as Datastructures::apply_batch. The mutations are divided
+    // between the shards, checked by them in parallel, and applied in parallel
+    // if they are all valid. Since the validity of a mutation only depends on
+    // the earlier mutations of the same place, the first invalid mutation is
+    // the first one of those found by the shards.
+    std::size_t apply_batch(std::vector<Mutation> const& mutations);
+
+private:
+    struct Shard
+    {
+        Datastructures ds;
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable wakeup;
+        std::deque<std::function<void()>> tasks; // Protected by mutex
+        bool stopping = false; // Protected by mutex
+    };
+
+    // Merged order of the places, and the generations of the shards it is from
+    struct MergedOrder
+    {
+        std::vector<std::uint64_t> generations;
+        std::vector<PlaceID> places;
+    };
+    template <typename Func>
+    std::vector<PlaceID> merged_order(MergedOrder& order, Func merge);
+
+    std::size_t shard_index(PlaceID id) const; // Shard of the place
+    static void run_shard(Shard& shard);
+
+    // Runs func(ds) in the thread of the shard, returns the future of its result
+    template <typename Func>
+    auto run(Shard& shard, Func func) -> std::future<decltype(func(shard.ds))>
+    {
+        // std::function must be copyable, so the task is kept behind a shared_ptr
+        using Result = decltype(func(shard.ds));
+        auto task = std::make_shared<std::packaged_task<Result()>>([&shard, func]() { return func(shard.ds); });
+        auto result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.tasks.push_back([task]() { (*task)(); });
+        }
+        shard.wakeup.notify_one();
+        return result;
+    }
+
+    // Runs func(ds) in all shards in parallel, returns the results in shard order
+    template <typename Func>
+    auto run_all(Func func) -> std::vector<decltype(func(std::declval<Datastructures&>()))>
+    {
+        std::vector<std::future<decltype(func(std::declval<Datastructures&>()))>> futures;
+        for (auto& shard : shards_) { futures.push_back(run(*shard, func)); }
+        std::vector<decltype(func(std::declval<Datastructures&>()))> results;
+        for (auto& future : futures) { results.push_back(future.get()); }
+        return results;
+    }
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::shared_mutex batch_mutex_; // Held exclusively by apply_batch, shared by the others
+    std::mutex order_mutex_;
+    MergedOrder name_order_; // Protected by order_mutex_
+    MergedOrder coord_order_; // Protected by order_mutex_
+};
+
+#endif // SHARDS_HH
@@ -0,0 +1,268 @@
+// Trace.cc
+
+#include "trace.hh"
+
+#include <istream>
+#include <iterator>
+#include <stdexcept>
+
+namespace
+{
+
+char const MAGIC[] = "PRG1TRC1";
+std::size_t const MAGIC_SIZE = sizeof(MAGIC) - 1;
+std::size_t const WRITE_BUFFER_SIZE = 64*1024;
+
+// Fields stored for each operation
+enum Field : unsigned int { ID1 = 1, ID2 = 2, NAME = 4, TYPE = 8, XY = 16, XY2 = 32, COORDS = 64 };
+
+unsigned int op_fields(TraceOp op)
+{
+    switch (op)
+    {
+    case TraceOp::ADD_PLACE:
+        return ID1 | NAME | TYPE | XY;
+    case TraceOp::GET_PLACE_NAME_TYPE:
+    case TraceOp::GET_PLACE_COORD:
+    case TraceOp::GET_AREA_NAME:
+    case TraceOp::GET_AREA_COORDS:
+    case TraceOp::SUBAREA_IN_AREAS:
+    case TraceOp::ALL_SUBAREAS_IN_AREA:
+    case TraceOp::REMOVE_PLACE:
+    case TraceOp::RANDOM_SEED:
+    case TraceOp::AREAS_OF_PLACE:
+    case TraceOp::AREA_STATS:
+        return ID1;
+    case TraceOp::FIND_PLACES_NAME:
+        return NAME;
+    case TraceOp::FIND_PLACES_TYPE:
+        return TYPE;
+    case TraceOp::CHANGE_PLACE_NAME:
+        return ID1 | NAME;
+    case TraceOp::CHANGE_PLACE_COORD:
+        return ID1 | XY;
+    case TraceOp::ADD_AREA:
+        return ID1 | NAME | COORDS;
+    case TraceOp::ADD_SUBAREA_TO_AREA:
+    case TraceOp::COMMON_AREA_OF_SUBAREAS:
+    case TraceOp::PLACES_IN_AREA:
+    case TraceOp::PLACES_ALPHABETICALLY_PAGE:
+    case TraceOp::PLACES_COORD_ORDER_PAGE:
+        return ID1 | ID2;
+    case TraceOp::PLACES_CLOSEST_TO:
+        return TYPE | XY;
+    case TraceOp::AREAS_CONTAINING:
+        return XY;
+    case TraceOp::RANDOM_ADD:
+        return ID1 | XY | XY2;
+    default:
+        return 0;
+    }
+}
+
+void put_unsigned(std::string& buffer, std::uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        buffer += static_cast<char>((value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    buffer += static_cast<char>(value);
+}
+
+void put_signed(std::string& buffer, long long int value)
+{
+    // Zigzag encoding, so that small negative numbers stay short
+    auto uvalue = static_cast<std::uint64_t>(value);
+    put_unsigned(buffer, (uvalue << 1) ^ ((value < 0) ? ~std::uint64_t(0) : 0));
+}
+
+void put_coord(std::string& buffer, Coord xy)
+{
+    put_signed(buffer, xy.x);
+    put_signed(buffer, xy.y);
+}
+
+// Decodes values from an in-memory trace, throwing if the data ends too early
+class TraceParser
+{
+public:
+    explicit TraceParser(std::string const& data) : data_(data) {}
+
+    bool at_end() const { return pos_ == data_.size(); }
+
+    std::uint8_t get_byte()
+    {
+        if (at_end()) { throw std::invalid_argument("Trace file is truncated"); }
+        return static_cast<std::uint8_t>(data_[pos_++]);
+    }
+
+    std::uint64_t get_unsigned()
+    {
+        std::uint64_t value = 0;
+        for (unsigned int shift = 0; shift < 64; shift += 7)
+        {
+            auto byte = get_byte();
+            value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) { return value; }
+        }
+        throw std::invalid_argument("Invalid integer in trace file");
+    }
+
+    long long int get_signed()
+    {
+        auto uvalue = get_unsigned();
+        return static_cast<long long int>((uvalue >> 1) ^ (~(uvalue & 1) + 1));
+    }
+
+    Coord get_coord()
+    {
+        Coord xy;
+        xy.x = static_cast<int>(get_signed());
+        xy.y = static_cast<int>(get_signed());
+        return xy;
+    }
+
+    std::string get_string()
+    {
+        auto size = get_unsigned();
+        if (size > data_.size() - pos_) { throw std::invalid_argument("Trace file is truncated"); }
+        std::string result = data_.substr(pos_, size);
+        pos_ += size;
+        return result;
+    }
+
+private:
+    std::string const& data_;
+    std::size_t pos_ = 0;
+};
+
+std::vector<TraceRecord> parse_records(TraceParser& parser)
+{
+    std::vector<TraceRecord> records;
+    while (!parser.at_end())
+    {
+        auto opbyte = parser.get_byte();
+        if (opbyte == 0 || opbyte >= static_cast<std::uint8_t>(TraceOp::OP_END))
+        {
+            throw std::invalid_argument("Unknown operation " + std::to_string(opbyte) + " in trace file");
+        }
+
+        TraceRecord record{static_cast<TraceOp>(opbyte)};
+        auto fields = op_fields(record.op);
+        if (fields & ID1) { record.id1 = parser.get_signed(); }
+        if (fields & ID2) { record.id2 = parser.get_signed(); }
+        if (fields & NAME) { record.name = parser.get_string(); }
+        if (fields & TYPE)
+        {
+            auto type = parser.get_unsigned();
+            if (type > static_cast<unsigned int>(PlaceType::NO_TYPE))
+            {
+                throw std::invalid_argument("Invalid place type in trace file");
+            }
+            record.type = static_cast<PlaceType>(type);
+        }
+        if (fields & XY) { record.xy = parser.get_coord(); }
+        if (fields & XY2) { record.xy2 = parser.get_coord(); }
+        if (fields & COORDS)
+        {
+            auto size = parser.get_unsigned();
+            for (std::uint64_t i = 0; i < size; ++i)
+            {
+                record.coords.push_back(parser.get_coord());
+            }
+        }
+        records.push_back(std::move(record));
+    }
+
+    return records;
+}
+
+} // namespace
+
+void encode_trace_record(std::string& buffer, TraceRecord const& record)
+{
+    auto fields = op_fields(record.op);
+
+    buffer += static_cast<char>(record.op);
+    if (fields & ID1) { put_signed(buffer, record.id1); }
+    if (fields & ID2) { put_signed(buffer, record.id2); }
+    if (fields & NAME)
+    {
+        put_unsigned(buffer, record.name.size());
+        buffer += record.name;
+    }
+    if (fields & TYPE) { put_unsigned(buffer, static_cast<unsigned int>(record.type)); }
+    if (fields & XY) { put_coord(buffer, record.xy); }
+    if (fields & XY2) { put_coord(buffer, record.xy2); }
+    if (fields & COORDS)
+    {
+        put_unsigned(buffer, record.coords.size());
+        for (auto xy : record.coords) { put_coord(buffer, xy); }
+    }
+}
+
+TraceWriter::TraceWriter(std::string const& filename, TraceHeader const& header) :
+    file_(filename, std::ios::binary)
+{
+    buffer_.reserve(WRITE_BUFFER_SIZE);
+    buffer_.append(MAGIC, MAGIC_SIZE);
+    for (auto value : {header.rand_state, header.prime1, header.prime2, header.random_places_added,
+                       header.random_areas_added, header.place_count})
+    {
+        put_unsigned(buffer_, value);
+    }
+}
+
+TraceWriter::~TraceWriter()
+{
+    close();
+}
+
+void TraceWriter::write(TraceRecord const& record)
+{
+    encode_trace_record(buffer_, record);
+    ++count_;
+
+    if (buffer_.size() >= WRITE_BUFFER_SIZE)
+    {
+        file_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        buffer_.clear();
+    }
+}
+
+void TraceWriter::close()
+{
+    if (!file_.is_open()) { return; }
+
+    file_.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+    buffer_.clear();
+    file_.close();
+}
+
+std::pair<TraceHeader, std::vector<TraceRecord>> read_trace(std::istream& input)
+{
+    std::string data(std::istreambuf_iterator<char>(input), {});
+    if (data.compare(0, MAGIC_SIZE, MAGIC) != 0)
+    {
+        throw std::invalid_argument("Not a trace file");
+    }
+    data.erase(0, MAGIC_SIZE);
+
+    TraceParser parser(data);
+    TraceHeader header;
+    header.rand_state = parser.get_unsigned();
+    header.prime1 = parser.get_unsigned();
+    header.prime2 = parser.get_unsigned();
+    header.random_places_added = parser.get_unsigned();
+    header.random_areas_added = parser.get_unsigned();
+    header.place_count = parser.get_unsigned();
+
+    return {header, parse_records(parser)};
+}
+
+std::vector<TraceRecord> decode_trace_records(std::string const& data)
+{
+    TraceParser parser(data);
+    return parse_records(parser);
+}
@@ -0,0 +1,96 @@
+// Trace.hh
+//
+// Compact binary traces of the Datastructures operations performed by
+// commands, for replaying recorded workloads as benchmarks
+
+#ifndef TRACE_HH
+#define TRACE_HH
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <iosfwd>
+
+#include "datastructures.hh"
+
+// Operations stored in a trace. The values are written to trace files, so
+// new operations must only be added to the end.
+enum class TraceOp : std::uint8_t
+{
+    PLACE_COUNT = 1, CLEAR_ALL, ALL_PLACES, ADD_PLACE, GET_PLACE_NAME_TYPE, GET_PLACE_COORD,
+    PLACES_ALPHABETICALLY, PLACES_COORD_ORDER, FIND_PLACES_NAME, FIND_PLACES_TYPE,
+    CHANGE_PLACE_NAME, CHANGE_PLACE_COORD, ADD_AREA, GET_AREA_NAME, GET_AREA_COORDS,
+    ALL_AREAS, ADD_SUBAREA_TO_AREA, SUBAREA_IN_AREAS, CREATION_FINISHED,
+    ALL_SUBAREAS_IN_AREA, PLACES_CLOSEST_TO, REMOVE_PLACE, COMMON_AREA_OF_SUBAREAS,
+    RANDOM_SEED, // id1 = new seed
+    RANDOM_ADD,  // id1 = number of places, xy = min, xy2 = max
+    AREAS_CONTAINING, INFER_SUBAREAS,
+    PLACES_IN_AREA, // id1 = area, id2 = recursive
+    AREAS_OF_PLACE, AREA_STATS,
+    PLACES_ALPHABETICALLY_PAGE, PLACES_COORD_ORDER_PAGE, // id1 = offset, id2 = limit
+    OP_END
+};
+
+// One recorded operation. Only the fields used by the operation are stored.
+struct TraceRecord
+{
+    TraceOp op;
+    long long int id1 = 0;
+    long long int id2 = 0;
+    Name name = {};
+    PlaceType type = PlaceType::NO_TYPE;
+    Coord xy = NO_COORD;
+    Coord xy2 = NO_COORD;
+    std::vector<Coord> coords = {};
+};
+
+// Program state at the start of recording, needed to reproduce the random
+// operations (random_add) of the trace exactly
+struct TraceHeader
+{
+    std::uint64_t rand_state = 0; // State of the random engine
+    std::uint64_t prime1 = 0;
+    std::uint64_t prime2 = 0;
+    std::uint64_t random_places_added = 0;
+    std::uint64_t random_areas_added = 0;
+    std::uint64_t place_count = 0; // Number of places when recording started
+};
+
+// Writes a trace file: a header followed by one record per operation.
+// Integers are stored as variable-length (zigzag for signed) integers, so
+// a typical record takes only a few bytes.
+class TraceWriter
+{
+public:
+    TraceWriter(std::string const& filename, TraceHeader const& header);
+    ~TraceWriter();
+
+    TraceWriter(TraceWriter const&) = delete;
+    TraceWriter& operator=(TraceWriter const&) = delete;
+
+    bool good() const { return file_.good(); }
+    unsigned long int count() const { return count_; }
+
+    void write(TraceRecord const& record);
+    void close(); // Writes buffered records to the file and closes it
+
+private:
+    std::ofstream file_;
+    std::string buffer_;
+    unsigned long int count_ = 0;
+};
+
+// Appends the binary encoding of the record to buffer
+void encode_trace_record(std::string& buffer, TraceRecord const& record);
+
+// Decodes records encoded with encode_trace_record. Throws std::invalid_argument
+// if the data is not valid.
+std::vector<TraceRecord> decode_trace_records(std::string const& data);
+
+// Reads a whole trace into memory. Throws std::invalid_argument if the input
+// is not a valid trace.
+std::pair<TraceHeader, std::vector<TraceRecord>> read_trace(std::istream& input);
+
+#endif // TRACE_HH
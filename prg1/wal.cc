@@ -0,0 +1,364 @@
+// Wal.cc
+
+#include "wal.hh"
+
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+char const MAGIC[] = "PRG1WAL1";
+std::size_t const MAGIC_SIZE = sizeof(MAGIC) - 1;
+
+// Thin wrappers for the unbuffered file operations needed for syncing
+
+int open_file(std::string const& filename, bool truncate)
+{
+#ifdef _WIN32
+    return _open(filename.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY | (truncate ? _O_TRUNC : 0),
+                 _S_IREAD | _S_IWRITE);
+#else
+    return ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | (truncate ? O_TRUNC : 0), 0644);
+#endif
+}
+
+bool write_file(int fd, std::string const& data)
+{
+    std::size_t written = 0;
+    while (written < data.size())
+    {
+#ifdef _WIN32
+        auto result = _write(fd, data.data() + written, static_cast<unsigned int>(data.size() - written));
+#else
+        auto result = ::write(fd, data.data() + written, data.size() - written);
+#endif
+        if (result <= 0) { return false; }
+        written += static_cast<std::size_t>(result);
+    }
+    return true;
+}
+
+bool sync_file(int fd)
+{
+#ifdef _WIN32
+    return _commit(fd) == 0;
+#else
+    return ::fsync(fd) == 0;
+#endif
+}
+
+bool resize_file(int fd, std::uint64_t size)
+{
+#ifdef _WIN32
+    return _chsize_s(fd, static_cast<long long int>(size)) == 0;
+#else
+    return ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+}
+
+void close_file(int fd)
+{
+#ifdef _WIN32
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+std::uint32_t crc32(std::string const& data)
+{
+    static std::array<std::uint32_t, 256> const table = []()
+    {
+        std::array<std::uint32_t, 256> result = {};
+        for (std::uint32_t i = 0; i < 256; ++i)
+        {
+            std::uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                value = (value & 1) ? (0xedb88320u ^ (value >> 1)) : (value >> 1);
+            }
+            result[i] = value;
+        }
+        return result;
+    }();
+
+    std::uint32_t crc = 0xffffffffu;
+    for (unsigned char byte : data)
+    {
+        crc = table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffffu;
+}
+
+// Header of a frame containing the payload
+std::string frame_header(std::string const& payload)
+{
+    std::string header;
+    for (std::uint64_t size = payload.size(); ; size >>= 7)
+    {
+        if (size < 0x80)
+        {
+            header += static_cast<char>(size);
+            break;
+        }
+        header += static_cast<char>((size & 0x7f) | 0x80);
+    }
+    auto crc = crc32(payload);
+    for (int i = 0; i < 4; ++i)
+    {
+        header += static_cast<char>((crc >> (8*i)) & 0xff);
+    }
+    return header;
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(std::string const& filename, unsigned int group_size, std::chrono::milliseconds max_delay) :
+    filename_(filename),
+    group_size_(group_size),
+    max_delay_(max_delay)
+{
+    bool exists = std::filesystem::exists(filename);
+    fd_ = open_file(filename, false);
+    if (fd_ < 0) { return; }
+    if (!exists || std::filesystem::file_size(filename) == 0)
+    {
+        if (!write_file(fd_, std::string(MAGIC, MAGIC_SIZE)) || !sync_file(fd_))
+        {
+            close_file(fd_);
+            fd_ = -1;
+            return;
+        }
+    }
+    good_size_ = std::filesystem::file_size(filename);
+
+    flusher_ = std::thread(&WriteAheadLog::flusher, this);
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    if (flusher_.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(buffer_mutex_);
+            stopping_ = true;
+        }
+        wakeup_.notify_one();
+        flusher_.join();
+    }
+    if (fd_ >= 0)
+    {
+        commit();
+        close_file(fd_);
+    }
+}
+
+bool WriteAheadLog::good() const
+{
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    return fd_ >= 0 && !failed_;
+}
+
+unsigned long int WriteAheadLog::count() const
+{
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    return count_;
+}
+
+unsigned long int WriteAheadLog::commits() const
+{
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    return commits_;
+}
+
+bool WriteAheadLog::is_mutation(TraceOp op)
+{
+    switch (op)
+    {
+    case TraceOp::CLEAR_ALL:
+    case TraceOp::ADD_PLACE:
+    case TraceOp::CHANGE_PLACE_NAME:
+    case TraceOp::CHANGE_PLACE_COORD:
+    case TraceOp::ADD_AREA:
+    case TraceOp::ADD_SUBAREA_TO_AREA:
+    case TraceOp::REMOVE_PLACE:
+    case TraceOp::INFER_SUBAREAS:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void WriteAheadLog::append(TraceRecord const& record)
+{
+    if (!is_mutation(record.op)) { return; }
+
+    bool full = false;
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        encode_trace_record(pending_, record);
+        ++count_;
+        full = (++pending_count_ >= group_size_);
+    }
+    if (full) { wakeup_.notify_one(); }
+}
+
+bool WriteAheadLog::commit()
+{
+    std::lock_guard<std::mutex> file_lock(file_mutex_);
+    std::string payload;
+    unsigned int payload_count = 0;
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        if (pending_count_ == 0) { return fd_ >= 0 && !failed_; }
+        payload.swap(pending_);
+        std::swap(payload_count, pending_count_);
+    }
+
+    auto frame = frame_header(payload) + payload;
+    if (good_size_ < MAGIC_SIZE)
+    {
+        // An earlier truncate failed after emptying the file
+        frame.insert(0, MAGIC, MAGIC_SIZE);
+        good_size_ = 0;
+    }
+    bool ok = write_file(fd_, frame) && sync_file(fd_);
+    if (ok)
+    {
+        good_size_ += frame.size();
+    }
+    else
+    {
+        // Remove what was written of the frame, and keep its records for the
+        // next commit, in front of the records appended meanwhile
+        resize_file(fd_, good_size_);
+    }
+
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    failed_ = !ok;
+    if (ok)
+    {
+        ++commits_;
+    }
+    else
+    {
+        pending_.insert(0, payload);
+        pending_count_ += payload_count;
+    }
+    return ok;
+}
+
+bool WriteAheadLog::truncate()
+{
+    std::lock_guard<std::mutex> file_lock(file_mutex_);
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex_);
+        pending_.clear();
+        pending_count_ = 0;
+    }
+    bool ok = resize_file(fd_, 0) && write_file(fd_, std::string(MAGIC, MAGIC_SIZE)) && sync_file(fd_);
+    if (ok)
+    {
+        good_size_ = MAGIC_SIZE;
+    }
+    else
+    {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(filename_, ec);
+        good_size_ = (ec || size < MAGIC_SIZE) ? 0 : size;
+    }
+
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    failed_ = !ok;
+    return ok;
+}
+
+void WriteAheadLog::flusher()
+{
+    std::unique_lock<std::mutex> lock(buffer_mutex_);
+    while (!stopping_)
+    {
+        wakeup_.wait_for(lock, max_delay_, [this](){ return stopping_ || pending_count_ >= group_size_; });
+        if (pending_count_ > 0)
+        {
+            lock.unlock();
+            commit();
+            lock.lock();
+        }
+    }
+}
+
+bool write_snapshot(std::string const& filename, std::vector<TraceRecord> const& records)
+{
+    std::string payload;
+    for (auto const& record : records) { encode_trace_record(payload, record); }
+
+    std::string tmpname = filename + ".tmp";
+    int fd = open_file(tmpname, true);
+    if (fd < 0) { return false; }
+    std::string data(MAGIC, MAGIC_SIZE);
+    if (!payload.empty()) { data += frame_header(payload) + payload; }
+    bool ok = write_file(fd, data) && sync_file(fd);
+    close_file(fd);
+
+    std::error_code ec;
+    if (ok) { std::filesystem::rename(tmpname, filename, ec); }
+    return ok && !ec;
+}
+
+std::vector<TraceRecord> read_log(std::string const& filename, std::uint64_t& valid_size)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) { throw std::invalid_argument("Cannot open file '" + filename + "'"); }
+    std::string data(std::istreambuf_iterator<char>(file), {});
+    if (data.compare(0, MAGIC_SIZE, MAGIC) != 0)
+    {
+        throw std::invalid_argument("'" + filename + "' is not a log file");
+    }
+
+    std::vector<TraceRecord> records;
+    std::size_t pos = MAGIC_SIZE;
+    while (pos < data.size())
+    {
+        // Stop at the first frame that is incomplete or fails the checksum
+        std::uint64_t size = 0;
+        std::size_t header_pos = pos;
+        for (unsigned int shift = 0; header_pos < data.size() && shift < 64; shift += 7)
+        {
+            auto byte = static_cast<unsigned char>(data[header_pos++]);
+            size |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) { break; }
+        }
+        if (header_pos + 4 > data.size() || size > data.size() - header_pos - 4) { break; }
+
+        std::string payload = data.substr(header_pos + 4, size);
+        if (frame_header(payload) != data.substr(pos, header_pos + 4 - pos)) { break; }
+
+        auto frame_records = decode_trace_records(payload);
+        records.insert(records.end(), std::make_move_iterator(frame_records.begin()), std::make_move_iterator(frame_records.end()));
+        pos = header_pos + 4 + size;
+    }
+
+    valid_size = pos;
+    return records;
+}
+
+bool truncate_file(std::string const& filename, std::uint64_t size)
+{
+    std::error_code ec;
+    std::filesystem::resize_file(filename, size, ec);
+    return !ec;
+}
@@ -0,0 +1,92 @@
+// Wal.hh
+//
+// Write-ahead log of the Datastructures mutations, with snapshots, so that
+// the data survives a crash of the program
+
+#ifndef WAL_HH
+#define WAL_HH
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trace.hh"
+
+// Log and snapshot files consist of frames: payload size (variable-length
+// integer), CRC-32 of the payload (4 bytes) and the payload, which is one or
+// more records encoded with encode_trace_record. A frame that was only
+// partially written when the program crashed fails the checksum, and is
+// ignored with everything after it.
+
+// Appends mutation records to a log file. Records are written and synced to
+// disk (fsync) in groups by a background thread: when group_size records are
+// waiting or max_delay has passed since the last commit. append() only
+// encodes the record into memory, so a crash loses at most the records of
+// the last max_delay. If writing or syncing a group fails, the partly
+// written frame is cut off the file, so that it does not hide the frames
+// after it from read_log, and the group is tried again with the next commit.
+class WriteAheadLog
+{
+public:
+    WriteAheadLog(std::string const& filename, unsigned int group_size = 1024,
+                  std::chrono::milliseconds max_delay = std::chrono::milliseconds(10));
+    ~WriteAheadLog(); // Commits the remaining records
+
+    WriteAheadLog(WriteAheadLog const&) = delete;
+    WriteAheadLog& operator=(WriteAheadLog const&) = delete;
+
+    // False if the file could not be opened, or the last commit failed: the
+    // records appended before it are not yet safely on disk
+    bool good() const;
+    std::string const& filename() const { return filename_; }
+    unsigned long int count() const; // Records appended
+    unsigned long int commits() const; // Groups synced to disk
+
+    // Operations that change the data. Other records are ignored by append().
+    static bool is_mutation(TraceOp op);
+
+    void append(TraceRecord const& record);
+    bool commit(); // Writes and syncs the waiting records now, returns good()
+    bool truncate(); // Empties the log (after a snapshot has been written), returns false if that fails
+
+private:
+    void flusher();
+
+    std::string filename_;
+    int fd_ = -1;
+    unsigned int group_size_;
+    std::chrono::milliseconds max_delay_;
+
+    mutable std::mutex buffer_mutex_; // Protects the members below
+    std::string pending_; // Encoded records waiting for commit
+    unsigned int pending_count_ = 0;
+    unsigned long int count_ = 0;
+    unsigned long int commits_ = 0;
+    bool stopping_ = false;
+    bool failed_ = false; // The last commit or truncate failed
+    std::condition_variable wakeup_;
+
+    std::mutex file_mutex_; // Held while writing to the file, protects good_size_
+    std::uint64_t good_size_ = 0; // Size of the file up to the end of the last complete frame
+    std::thread flusher_;
+};
+
+// Writes records to a file as one frame and syncs it. The file is first
+// written under a temporary name and then renamed, so an existing file is
+// replaced only by a complete one. Returns false if writing fails.
+bool write_snapshot(std::string const& filename, std::vector<TraceRecord> const& records);
+
+// Reads the records of all complete frames of a log or snapshot file. If the
+// file ends with an incomplete or corrupted frame, valid_size is set to the
+// size of the valid part, otherwise to the file size. Throws
+// std::invalid_argument if the file is not a log file.
+std::vector<TraceRecord> read_log(std::string const& filename, std::uint64_t& valid_size);
+
+// Cuts the file to the given size (to remove an incomplete frame from the end)
+bool truncate_file(std::string const& filename, std::uint64_t size);
+
+#endif // WAL_HH